@@ -23,16 +23,38 @@ using std::complex;
 #endif
 
 #include "AudioStreams/AudioStream.h"
+#include "AudioRecorder.h"
+#include "LoudnessMeter.h"
+#include "SpectralFeatures.h"
 #include "ShaderConfig.h" // AudioOptions
 
 #include "ffts.h"
 
 static const int VISUALIZER_BUFSIZE = 2 * 1024;
+// Number of past spectra kept for the spectrogram, about 8.5 seconds of analysis frames
+static const int SPECTROGRAM_LEN = 512;
 struct AudioData {
     float* audio_l;
     float* audio_r;
     float* freq_l;
     float* freq_r;
+    // When the newest sample in audio_l/audio_r was captured
+    std::chrono::steady_clock::time_point capture_time;
+    // momentary rms, short term rms, momentary loudness (LUFS), short term loudness (LUFS)
+    float loudness[4];
+    // true peak of the left and right channels since the last frame
+    float peak[2];
+    // spectral centroid (hz), flux, rolloff (hz), flatness
+    float spectral[4];
+    // energy of each pitch class starting at C, the largest is 1
+    float chroma[12];
+    // Ring of the last SPECTROGRAM_LEN freq_l/freq_r frames. Frame n is in column n % SPECTROGRAM_LEN
+    // and each column holds VISUALIZER_BUFSIZE interleaved left and right values.
+    float* spectrogram;
+    // Number of frames written to spectrogram so far
+    int spectrogram_frames;
+    // Incremented every time a new analysis frame is published, readers can skip work while it is unchanged
+    int generation;
     std::mutex mtx;
 };
 
@@ -117,6 +139,10 @@ public:
     AudioData& get_audio_data() {
         return audio_sink;
     }
+    // Must be set before the audio thread starts. Every captured frame is given to the recorder.
+    void set_recorder(AudioRecorder* r) {
+        recorder = r;
+    }
     void set_audio_options(AudioOptions& ao) {
         xcorr_sync = ao.xcorr_sync;
         fft_sync = ao.fft_sync;
@@ -154,6 +180,9 @@ private:
     typename ClockT::time_point next_time;
     int frame_id = 0;
 
+    // When the frame just before writer was captured
+    chrono::steady_clock::time_point writer_capture_time;
+
     float* history_buff_l[HISTORY_NUM_FRAMES];
     float* history_buff_r[HISTORY_NUM_FRAMES];
 
@@ -178,6 +207,12 @@ private:
 
     struct AudioData audio_sink;
     AudioStreamT& audio_stream;
+    AudioRecorder* recorder = nullptr;
+    LoudnessMeter loudness_meter;
+    SpectralFeatures spectral_features;
+
+    // Gives the n frames just written at writer to everything that needs the raw captured audio
+    void consume_captured(int n);
 
     // Returns the bin holding the max frequency of the fft. we only consider the first 100 bins.
     static int max_bin(const complex<float>* f);
@@ -213,11 +248,14 @@ private:
 
     // converts number of seconds x to a time duration for the ClockT type
     static typename ClockT::duration dura(float x);
+
+    // converts a number of frames of SR audio to the time they span
+    static chrono::steady_clock::duration frames_to_duration(int frames);
 };
 
 template <typename ClockT, typename AudioStreamT>
 AudioProcess<ClockT, AudioStreamT>::AudioProcess(AudioStreamT& _audio_stream, AudioOptions audio_options)
-    : audio_stream(_audio_stream), audio_sink() {
+    : audio_stream(_audio_stream), audio_sink(), spectral_features(FFTLEN / 2 + 1, float(SRF) / FFTLEN) {
     if (audio_stream.get_sample_rate() != 48000) {
         std::cout << "The AudioProcess is meant to consume 48000hz audio but the given AudioStream "
             << "produces " << audio_stream.get_sample_rate() << "hz audio." << std::endl;
@@ -248,6 +286,9 @@ AudioProcess<ClockT, AudioStreamT>::AudioProcess(AudioStreamT& _audio_stream, Au
     audio_sink.audio_r = new float[VL]();
     audio_sink.freq_l = new float[VL]();
     audio_sink.freq_r = new float[VL]();
+    audio_sink.spectrogram = new float[SPECTROGRAM_LEN * VL * 2]();
+    audio_sink.spectrogram_frames = 0;
+    audio_sink.generation = 0;
 
     const int N = FFTLEN;
     fft_plan = ffts_init_1d_real(N, FFTS_FORWARD);
@@ -278,6 +319,7 @@ AudioProcess<ClockT, AudioStreamT>::~AudioProcess() {
     delete[] audio_sink.audio_r;
     delete[] audio_sink.freq_l;
     delete[] audio_sink.freq_r;
+    delete[] audio_sink.spectrogram;
     delete[] audio_buff_l;
     delete[] audio_buff_r;
 
@@ -298,7 +340,28 @@ AudioProcess<ClockT, AudioStreamT>::~AudioProcess() {
 template <typename ClockT, typename AudioStreamT>
 void AudioProcess<ClockT, AudioStreamT>::step() {
     audio_stream.get_next_pcm(audio_buff_l + writer, audio_buff_r + writer, ABL);
+    consume_captured(ABL);
     writer = move_index(writer, ABL, TBL);
+    // get_next_pcm returns as soon as the last frame of the block is captured
+    writer_capture_time = chrono::steady_clock::now();
+
+    // If we were descheduled for a while then the stream is holding a backlog of audio. Drain all
+    // of it now so that this step analyses the newest audio instead of catching up one block per step.
+    int backlog_space = TBL - ABL;
+    while (backlog_space > 0) {
+        chrono::steady_clock::time_point capture_time;
+        const int max_frames = std::min(backlog_space, TBL - writer);
+        const int n = audio_stream.get_available_pcm(audio_buff_l + writer, audio_buff_r + writer, max_frames, capture_time);
+        if (n <= 0)
+            break;
+        consume_captured(n);
+        writer = move_index(writer, n, TBL);
+        backlog_space -= n;
+        writer_capture_time = capture_time + frames_to_duration(n - 1);
+        // A short read took everything the stream had captured
+        if (n < max_frames)
+            break;
+    }
 
     const auto now_time = ClockT::now();
     if (now_time - next_time > chrono::milliseconds(60)) {
@@ -317,6 +380,7 @@ void AudioProcess<ClockT, AudioStreamT>::step() {
         fft_out_r[0] = 0;
         fft_out_l[1] = 0;
         fft_out_r[1] = 0;
+        spectral_features.compute(fft_out_l, fft_out_r, 1.f / std::sqrt(float(FFTLEN)));
 
         if (fft_sync) {
             freq_l = get_harmonic_less_than(max_frequency(fft_out_l), 80.f);
@@ -351,7 +415,20 @@ void AudioProcess<ClockT, AudioStreamT>::step() {
         channel_max_l = mix(channel_max_l, max_amplitude_l, .3f);
         channel_max_r = mix(channel_max_r, max_amplitude_r, .3f);
 
+        // The newest sample we output is VL frames after the reader that is closest to the writer
+        const int newest_dist = std::min(dist_forward(move_index(reader_l, VL, TBL), writer, TBL),
+                                         dist_forward(move_index(reader_r, VL, TBL), writer, TBL));
+
         audio_sink.mtx.lock();
+        audio_sink.capture_time = writer_capture_time - frames_to_duration(newest_dist);
+        audio_sink.loudness[0] = loudness_meter.momentary_rms();
+        audio_sink.loudness[1] = loudness_meter.short_term_rms();
+        audio_sink.loudness[2] = loudness_meter.momentary_loudness();
+        audio_sink.loudness[3] = loudness_meter.short_term_loudness();
+        audio_sink.peak[0] = loudness_meter.take_peak(0);
+        audio_sink.peak[1] = loudness_meter.take_peak(1);
+        std::copy(spectral_features.spectral, spectral_features.spectral + 4, audio_sink.spectral);
+        std::copy(spectral_features.chroma, spectral_features.chroma + 12, audio_sink.chroma);
         for (int i = 0; i < VL; ++i) {
             float sample_l = .66f * audio_buff_l[(i + reader_l) % TBL] / (channel_max_l + 0.0001f);
             float sample_r = .66f * audio_buff_r[(i + reader_r) % TBL] / (channel_max_r + 0.0001f);
@@ -376,6 +453,15 @@ void AudioProcess<ClockT, AudioStreamT>::step() {
             audio_sink.freq_l[i] = sum_l / weight_sum;
             audio_sink.freq_r[i] = sum_r / weight_sum;
         }
+
+        // Keep a history of spectra so the renderer only has to upload the newest one each frame
+        float* column = audio_sink.spectrogram + (audio_sink.spectrogram_frames % SPECTROGRAM_LEN) * VL * 2;
+        for (int i = 0; i < VL; ++i) {
+            column[2 * i + 0] = audio_sink.freq_l[i];
+            column[2 * i + 1] = audio_sink.freq_r[i];
+        }
+        audio_sink.spectrogram_frames++;
+        audio_sink.generation++;
         audio_sink.mtx.unlock();
 
         frame_id++;
@@ -383,6 +469,13 @@ void AudioProcess<ClockT, AudioStreamT>::step() {
     }
 }
 
+template <typename ClockT, typename AudioStreamT>
+void AudioProcess<ClockT, AudioStreamT>::consume_captured(int n) {
+    if (recorder)
+        recorder->push(audio_buff_l + writer, audio_buff_r + writer, n);
+    loudness_meter.process(audio_buff_l + writer, audio_buff_r + writer, n);
+}
+
 template <typename ClockT, typename AudioStreamT>
 int AudioProcess<ClockT, AudioStreamT>::max_bin(const complex<float>* f) {
     float max_norm = 0.f;
@@ -521,3 +614,8 @@ typename ClockT::duration AudioProcess<ClockT, AudioStreamT>::dura(float x) {
     return chrono::duration_cast<typename ClockT::duration>(
         chrono::duration<float, std::ratio<1>>(x));
 }
+
+template <typename ClockT, typename AudioStreamT>
+chrono::steady_clock::duration AudioProcess<ClockT, AudioStreamT>::frames_to_duration(int frames) {
+    return chrono::duration_cast<chrono::steady_clock::duration>(chrono::microseconds(int64_t(frames) * 1000000 / SR));
+}
@@ -0,0 +1,147 @@
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+using std::runtime_error;
+
+#include "AudioRecorder.h"
+#include "AudioStreams/wav_format.h"
+
+static const int WAV_HEADER_SIZE = sizeof(wav_header_t) + sizeof(chunk_t);
+
+AudioRecorder::AudioRecorder(const filesys::path& path, int sample_rate)
+    : queue(new Block[QUEUE_BLOCKS]), head(0), tail(0), stop(false), dropped_frames(0),
+      staging(new Page[WRITE_SIZE / sizeof(Page)]), staging_fill(0), sample_rate(sample_rate), data_bytes(0) {
+    is_wav = path.extension() != ".f32";
+    file = fopen(path.string().c_str(), "wb");
+    if (!file)
+        throw runtime_error("AudioRecorder: could not open " + path.string() + " for writing");
+    // We already write in large chunks, don't copy them through another buffer
+    setvbuf(file, nullptr, _IONBF, 0);
+
+    // The header is staged like everything else so that every write to the file is WRITE_SIZE
+    // bytes and starts at a WRITE_SIZE aligned offset, except for the periodic flushes. The sizes in
+    // it are fixed up by every flush.
+    if (is_wav) {
+        write_wav_header(staging[0].bytes);
+        staging_fill = WAV_HEADER_SIZE;
+    }
+
+    writer_thread = std::thread(&AudioRecorder::writer_loop, this);
+}
+
+AudioRecorder::~AudioRecorder() {
+    stop.store(true, std::memory_order_release);
+    writer_thread.join();
+
+    flush_staging();
+    update_wav_header();
+    fclose(file);
+
+    if (dropped_frames)
+        cout << "AudioRecorder: dropped " << dropped_frames << " frames because the disk could not keep up" << endl;
+}
+
+void AudioRecorder::push(const float* buff_l, const float* buff_r, int size) {
+    int i = 0;
+    while (i < size) {
+        const uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == QUEUE_BLOCKS) {
+            dropped_frames += size - i;
+            return;
+        }
+        Block& b = queue[h % QUEUE_BLOCKS];
+        b.frames = std::min(size - i, BLOCK_FRAMES);
+        for (int j = 0; j < b.frames; ++j) {
+            b.samples[j * CHANNELS + 0] = buff_l[i + j];
+            b.samples[j * CHANNELS + 1] = buff_r[i + j];
+        }
+        i += b.frames;
+        head.store(h + 1, std::memory_order_release);
+    }
+}
+
+void AudioRecorder::writer_loop() {
+    auto last_flush = std::chrono::steady_clock::now();
+    while (true) {
+        // Keep the file playable up to the last second in case the show doesn't end cleanly
+        const auto now = std::chrono::steady_clock::now();
+        if (now - last_flush >= std::chrono::milliseconds(FLUSH_INTERVAL_MS)) {
+            flush_staging();
+            update_wav_header();
+            last_flush = now;
+        }
+
+        // Read stop before head so that every block pushed before stop was set is written
+        const bool stopping = stop.load(std::memory_order_acquire);
+        const uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            if (stopping)
+                return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        const Block& b = queue[t % QUEUE_BLOCKS];
+        stage((const char*)b.samples, b.frames * CHANNELS * sizeof(float));
+        tail.store(t + 1, std::memory_order_release);
+    }
+}
+
+void AudioRecorder::stage(const char* bytes, int size) {
+    char* dst = staging[0].bytes;
+    data_bytes += size;
+    while (size) {
+        const int n = std::min(size, WRITE_SIZE - staging_fill);
+        memcpy(dst + staging_fill, bytes, n);
+        staging_fill += n;
+        bytes += n;
+        size -= n;
+        if (staging_fill == WRITE_SIZE)
+            flush_staging();
+    }
+}
+
+void AudioRecorder::flush_staging() {
+    if (staging_fill && fwrite(staging[0].bytes, 1, staging_fill, file) != size_t(staging_fill))
+        cout << "AudioRecorder: write failed" << endl;
+    staging_fill = 0;
+}
+
+void AudioRecorder::update_wav_header() {
+    if (!is_wav)
+        return;
+    char header[WAV_HEADER_SIZE];
+    write_wav_header(header);
+    fseek(file, 0, SEEK_SET);
+    if (fwrite(header, 1, WAV_HEADER_SIZE, file) != size_t(WAV_HEADER_SIZE))
+        cout << "AudioRecorder: write failed" << endl;
+    fseek(file, 0, SEEK_END);
+}
+
+void AudioRecorder::write_wav_header(char* dst) const {
+    // wav sizes are 32 bit, so files longer than about 3 hours at 48000hz will have a wrong size
+    const uint32_t data_size = uint32_t(std::min<uint64_t>(data_bytes, UINT32_MAX - WAV_HEADER_SIZE));
+
+    wav_header_t header;
+    memcpy(header.chunkID, "RIFF", 4);
+    header.chunkSize = data_size + WAV_HEADER_SIZE - 8;
+    memcpy(header.format, "WAVE", 4);
+    memcpy(header.subchunk1ID, "fmt ", 4);
+    header.subchunk1Size = 16;
+    header.audioFormat = WAV_FORMAT_IEEE_FLOAT;
+    header.numChannels = CHANNELS;
+    header.sampleRate = sample_rate;
+    header.byteRate = sample_rate * CHANNELS * sizeof(float);
+    header.blockAlign = CHANNELS * sizeof(float);
+    header.bitsPerSample = 8 * sizeof(float);
+
+    chunk_t chunk;
+    memcpy(chunk.ID, "data", 4);
+    chunk.size = data_size;
+
+    memcpy(dst, &header, sizeof(header));
+    memcpy(dst + sizeof(header), &chunk, sizeof(chunk));
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <cstdio>
+#include <cstdint>
+
+#include "filesystem.h"
+
+// Records the captured audio to disk so that a show can be replayed through WavAudioStream.
+// Writes a 32 bit float .wav file, or headerless interleaved floats if the extension is .f32.
+//
+// The audio thread must never wait on the disk, so push() only copies into a lock free single
+// producer single consumer queue of blocks. A background thread drains the queue and writes it to
+// the file in large page aligned chunks, and at least once a second writes out what it has and the
+// sizes in the wav header, so a crash or Ctrl-C during a show loses at most the last second.
+class AudioRecorder {
+public:
+    AudioRecorder(const filesys::path& path, int sample_rate);
+    // Writes whatever is still queued and finishes the file
+    ~AudioRecorder();
+
+    // Called by the audio thread. Never blocks, if the writer has fallen behind the frames are dropped.
+    void push(const float* buff_l, const float* buff_r, int size);
+
+    long long get_dropped_frames() const {
+        return dropped_frames;
+    }
+
+private:
+    AudioRecorder(AudioRecorder&) = delete;
+    AudioRecorder& operator=(AudioRecorder&) = delete;
+
+    static const int CHANNELS = 2;
+    static const int BLOCK_FRAMES = 512;
+    // About 5 seconds of 48000hz audio
+    static const int QUEUE_BLOCKS = 512;
+    static const int WRITE_SIZE = 1 << 20;
+    // Longest audio is kept in staging before it's written out
+    static constexpr int FLUSH_INTERVAL_MS = 1000;
+
+    struct Block {
+        int frames;
+        float samples[CHANNELS * BLOCK_FRAMES];
+    };
+    std::unique_ptr<Block[]> queue;
+    // Only the audio thread writes head and only the writer thread writes tail
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::atomic<bool> stop;
+    std::atomic<long long> dropped_frames;
+
+    struct alignas(4096) Page {
+        char bytes[4096];
+    };
+    std::unique_ptr<Page[]> staging;
+    int staging_fill;
+
+    FILE* file;
+    bool is_wav;
+    int sample_rate;
+    uint64_t data_bytes;
+
+    std::thread writer_thread;
+    void writer_loop();
+    void stage(const char* bytes, int size);
+    void flush_staging();
+    void write_wav_header(char* dst) const;
+    // Rewrites the header at the start of the file with the sizes of the data written so far
+    void update_wav_header();
+};
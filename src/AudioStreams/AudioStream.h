@@ -1,8 +1,14 @@
 #pragma once
 
+#include <chrono>
+
 class AudioStream {
 public:
+	// Blocks until buff_size frames have been read
 	virtual void get_next_pcm(float* buff_l, float* buff_r, int buff_size) = 0;
+	// Reads up to max_frames frames that the system has already captured, without blocking.
+	// Returns the number of frames read, and sets capture_time to when the first of them was captured.
+	virtual int get_available_pcm(float* buff_l, float* buff_r, int max_frames, std::chrono::steady_clock::time_point& capture_time) = 0;
 	virtual int get_sample_rate() = 0;
 	virtual int get_max_buff_size() = 0;
 };
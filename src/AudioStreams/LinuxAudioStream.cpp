@@ -1,14 +1,33 @@
 #include <iostream>
 using std::cout; using std::endl;
+#include <algorithm>
 
 #include "LinuxAudioStream.h"
 
+static void exit_with_error(const char* what, int error) {
+	cout << what << " failed: " << pa_strerror(error) << endl;
+	exit(EXIT_FAILURE);
+}
+
 LinuxAudioStream::LinuxAudioStream() {
 	std::string sink_name;
 	getPulseDefaultSink((void*)&sink_name);
 	sink_name += ".monitor";
 
-	buf_interlaced = new float[sample_rate * channels];
+	mainloop = pa_threaded_mainloop_new();
+	context = pa_context_new(pa_threaded_mainloop_get_api(mainloop), "Music Visualizer");
+	pa_context_set_state_callback(context, &LinuxAudioStream::context_state_callback, this);
+
+	pa_threaded_mainloop_lock(mainloop);
+	if (pa_context_connect(context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0)
+		exit_with_error("pa_context_connect()", pa_context_errno(context));
+	if (pa_threaded_mainloop_start(mainloop) < 0)
+		exit_with_error("pa_threaded_mainloop_start()", PA_ERR_INTERNAL);
+	while (pa_context_get_state(context) != PA_CONTEXT_READY) {
+		if (!PA_CONTEXT_IS_GOOD(pa_context_get_state(context)))
+			exit_with_error("Connecting to pulseaudio", pa_context_errno(context));
+		pa_threaded_mainloop_wait(mainloop);
+	}
 
 	pa_sample_spec pulseSampleSpec;
 	pulseSampleSpec.channels = channels;
@@ -16,32 +35,116 @@ LinuxAudioStream::LinuxAudioStream() {
 	pulseSampleSpec.format = PA_SAMPLE_FLOAT32NE;
 	pa_buffer_attr pb;
 	pb.fragsize = max_buff_size*channels*sizeof(float) / 2;
-	pb.maxlength = max_buff_size*channels*sizeof(float);
-	pulseState = pa_simple_new(NULL, "Music Visualizer", PA_STREAM_RECORD, sink_name.c_str(), "Music Visualizer", &pulseSampleSpec, NULL,
-	                  &pb, &pulseError);
-	if (!pulseState) {
-		cout << "Could not open pulseaudio source: " << sink_name.c_str() << " " << pa_strerror(pulseError)
-		     << ". To find a list of your pulseaudio sources run 'pacmd list-sources'" << endl;
-		exit(EXIT_FAILURE);
+	pb.maxlength = max_backlog_size*channels*sizeof(float);
+	pb.tlength = pb.prebuf = pb.minreq = (uint32_t) -1;
+	stream = pa_stream_new(context, "Music Visualizer", &pulseSampleSpec, NULL);
+	if (!stream)
+		exit_with_error("pa_stream_new()", pa_context_errno(context));
+	pa_stream_set_state_callback(stream, &LinuxAudioStream::stream_notify_callback, this);
+	pa_stream_set_read_callback(stream, &LinuxAudioStream::stream_read_callback, this);
+	const pa_stream_flags_t flags = pa_stream_flags_t(PA_STREAM_ADJUST_LATENCY | PA_STREAM_AUTO_TIMING_UPDATE | PA_STREAM_INTERPOLATE_TIMING);
+	if (pa_stream_connect_record(stream, sink_name.c_str(), &pb, flags) < 0)
+		exit_with_error("pa_stream_connect_record()", pa_context_errno(context));
+	while (pa_stream_get_state(stream) != PA_STREAM_READY) {
+		if (!PA_STREAM_IS_GOOD(pa_stream_get_state(stream))) {
+			cout << "Could not open pulseaudio source: " << sink_name.c_str() << " " << pa_strerror(pa_context_errno(context))
+			     << ". To find a list of your pulseaudio sources run 'pacmd list-sources'" << endl;
+			exit(EXIT_FAILURE);
+		}
+		pa_threaded_mainloop_wait(mainloop);
 	}
+	pa_threaded_mainloop_unlock(mainloop);
+
+	staged.reserve((max_backlog_size + max_buff_size) * channels);
 }
 
 LinuxAudioStream::~LinuxAudioStream() {
-	pa_simple_free(pulseState);
-	delete[] buf_interlaced;
+	pa_threaded_mainloop_lock(mainloop);
+	pa_stream_disconnect(stream);
+	pa_stream_unref(stream);
+	pa_context_disconnect(context);
+	pa_context_unref(context);
+	pa_threaded_mainloop_unlock(mainloop);
+	pa_threaded_mainloop_stop(mainloop);
+	pa_threaded_mainloop_free(mainloop);
+}
+
+void LinuxAudioStream::context_state_callback(pa_context* context, void* userdata) {
+	pa_threaded_mainloop_signal(static_cast<LinuxAudioStream*>(userdata)->mainloop, 0);
+}
+
+void LinuxAudioStream::stream_notify_callback(pa_stream* stream, void* userdata) {
+	pa_threaded_mainloop_signal(static_cast<LinuxAudioStream*>(userdata)->mainloop, 0);
+}
+
+void LinuxAudioStream::stream_read_callback(pa_stream* stream, size_t bytes, void* userdata) {
+	pa_threaded_mainloop_signal(static_cast<LinuxAudioStream*>(userdata)->mainloop, 0);
 }
 
 void LinuxAudioStream::get_next_pcm(float * buff_l, float * buff_r, int size) {
 	if (max_buff_size < size)
 		cout << "get_next_pcm called with size > max_buff_size" << endl;
-	if (pa_simple_read(pulseState, buf_interlaced, size*channels*sizeof(float), &pulseError) < 0) {
-		cout << "pa_simple_read() failed: " << pa_strerror(pulseError) << endl;
-		exit(EXIT_FAILURE);
+	pa_threaded_mainloop_lock(mainloop);
+	while (int(staged.size()) < size * channels) {
+		if (stage_fragment())
+			continue;
+		if (!PA_STREAM_IS_GOOD(pa_stream_get_state(stream)))
+			exit_with_error("Reading from pulseaudio", pa_context_errno(context));
+		// Woken by the read callback once the server captured more
+		pa_threaded_mainloop_wait(mainloop);
 	}
+	pa_threaded_mainloop_unlock(mainloop);
+	take_staged(buff_l, buff_r, size);
+}
+
+int LinuxAudioStream::get_available_pcm(float * buff_l, float * buff_r, int max_frames, std::chrono::steady_clock::time_point& capture_time) {
+	// Only takes what pa_stream_readable_size says the server already holds, the device's latency
+	// is audio that isn't captured yet
+	pa_threaded_mainloop_lock(mainloop);
+	while (int(staged.size()) < max_frames * channels && stage_fragment()) {}
+	pa_usec_t latency = 0;
+	int negative = 0;
+	if (pa_stream_get_latency(stream, &latency, &negative) < 0 || negative)
+		latency = 0;
+	pa_threaded_mainloop_unlock(mainloop);
+
+	const int staged_frames = int(staged.size()) / channels;
+	const int size = std::min(max_frames, staged_frames);
+	if (size <= 0)
+		return 0;
+	// The latency is the age of the oldest audio still in the stream, the staged frames are older
+	capture_time = std::chrono::steady_clock::now() - std::chrono::microseconds(latency)
+	               - std::chrono::microseconds(int64_t(staged_frames) * 1000000 / sample_rate);
+	take_staged(buff_l, buff_r, size);
+	return size;
+}
+
+bool LinuxAudioStream::stage_fragment() {
+	const size_t readable = pa_stream_readable_size(stream);
+	if (readable == 0 || readable == (size_t) -1)
+		return false;
+	const void* data;
+	size_t bytes;
+	if (pa_stream_peek(stream, &data, &bytes) < 0)
+		exit_with_error("pa_stream_peek()", pa_context_errno(context));
+	if (bytes == 0)
+		return false;
+	const size_t samples = bytes / sizeof(float);
+	// A hole in the stream reads as silence
+	if (data)
+		staged.insert(staged.end(), static_cast<const float*>(data), static_cast<const float*>(data) + samples);
+	else
+		staged.insert(staged.end(), samples, 0.f);
+	pa_stream_drop(stream);
+	return true;
+}
+
+void LinuxAudioStream::take_staged(float * buff_l, float * buff_r, int size) {
 	for (int i = 0; i < size; i++) {
-		buff_l[i] = buf_interlaced[i * channels + 0];
-		buff_r[i] = buf_interlaced[i * channels + 1];
+		buff_l[i] = staged[i * channels + 0];
+		buff_r[i] = staged[i * channels + 1];
 	}
+	staged.erase(staged.begin(), staged.begin() + size * channels);
 }
 
 int LinuxAudioStream::get_sample_rate() {
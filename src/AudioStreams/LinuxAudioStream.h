@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 #include "AudioStream.h"
 #include "pulse_misc.h"
 
@@ -8,15 +10,32 @@ public:
 	LinuxAudioStream();
 	~LinuxAudioStream();
 	void get_next_pcm(float* buff_l, float* buff_r, int size);
+	int get_available_pcm(float* buff_l, float* buff_r, int max_frames, std::chrono::steady_clock::time_point& capture_time);
 	int get_sample_rate();
 	int get_max_buff_size();
 
 private:
 	const int sample_rate = 48000;
 	const int max_buff_size = 512;
+	// How many frames pulse keeps for us while we are not reading
+	const int max_backlog_size = 512 * 16;
 	const int channels = 2;
 
-	float* buf_interlaced;
-	int pulseError;
-	pa_simple* pulseState;
+	// The asynchronous api, unlike pa_simple, tells how much captured audio can be read without waiting
+	pa_threaded_mainloop* mainloop;
+	pa_context* context;
+	pa_stream* stream;
+
+	// Interleaved frames taken from the stream but not read yet. pa_stream_peek hands out fragments
+	// of any size, which have to be dropped whole.
+	std::vector<float> staged;
+	// Moves a fragment of captured audio from the stream to staged, returns false if there was none.
+	// Must be called with the mainloop locked.
+	bool stage_fragment();
+	// Moves the first size frames of staged to buff_l and buff_r
+	void take_staged(float* buff_l, float* buff_r, int size);
+
+	static void context_state_callback(pa_context* context, void* userdata);
+	static void stream_notify_callback(pa_stream* stream, void* userdata);
+	static void stream_read_callback(pa_stream* stream, size_t bytes, void* userdata);
 };
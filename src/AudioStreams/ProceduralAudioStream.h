@@ -16,6 +16,11 @@ public:
 	void get_next_pcm(float* buff_l, float* buff_r, int buff_size) {
 		lambda(buff_l, buff_r, buff_size);
 	}
+	int get_available_pcm(float* buff_l, float* buff_r, int max_frames, std::chrono::steady_clock::time_point& capture_time) {
+		// Audio is generated on demand so there is never a backlog to drain
+		capture_time = std::chrono::steady_clock::now();
+		return 0;
+	}
 	int get_sample_rate() {
 		return sample_rate;
 	};
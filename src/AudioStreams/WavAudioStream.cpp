@@ -6,37 +6,17 @@ using std::ios;
 #include <cstdio>
 #include <stdexcept>
 #include <cstring> // memory stuff
+#include <vector>
+using std::vector;
+#include <algorithm>
+#include <thread>
 
 #include "WavAudioStream.h"
 
-// Create a WavStreamer backed by a CircularBuffer<short>?
-
-// https://github.com/tkaczenko/WavReader/blob/master/WavReader/WavReader.cpp
-//Wav Header
-struct wav_header_t {
-	char chunkID[4]; //"RIFF" = 0x46464952
-	unsigned long chunkSize; //28 [+ sizeof(wExtraFormatBytes) + wExtraFormatBytes] + sum(sizeof(chunk.id) + sizeof(chunk.size) + chunk.size)
-	char format[4]; //"WAVE" = 0x45564157
-	char subchunk1ID[4]; //"fmt " = 0x20746D66
-	unsigned long subchunk1Size; //16 [+ sizeof(wExtraFormatBytes) + wExtraFormatBytes]
-	unsigned short audioFormat;
-	unsigned short numChannels;
-	unsigned long sampleRate;
-	unsigned long byteRate;
-	unsigned short blockAlign;
-	unsigned short bitsPerSample;
-	//[WORD wExtraFormatBytes;]
-	//[Extra format bytes]
-};
-
-//Chunks
-struct chunk_t {
-	char ID[4]; //"data" = 0x61746164
-	unsigned long size;  //Chunk data bytes
-};
+#include "wav_format.h"
 
 // Reads entire file into buffer
-WavAudioStream::WavAudioStream(const filesys::path &wav_path) {
+WavAudioStream::WavAudioStream(const filesys::path &wav_path, bool realtime) : frames_read(0), realtime(realtime) {
 	if (!filesys::exists(wav_path))
 		throw std::runtime_error("WavAudioStream: wav file not found");
 	ifstream fin(wav_path.string(), std::ios::binary);
@@ -44,48 +24,62 @@ WavAudioStream::WavAudioStream(const filesys::path &wav_path) {
 		throw std::runtime_error("WavAudioStream: file did not open" );
 	fin.unsetf(ios::skipws);
 
+	if (wav_path.extension() == ".f32") {
+		sample_rate = 48000;
+		fin.seekg(0, ios::end);
+		const int samples_count = int(fin.tellg() / sizeof(float));
+		fin.seekg(0, ios::beg);
+		frames_count = samples_count / channels;
+		buf_interlaced = new float[samples_count];
+		fin.read((char*)buf_interlaced, samples_count * sizeof(float));
+		return;
+	}
+
 	//Read WAV header
 	wav_header_t header;
 	fin.read((char*)&header, sizeof(header));
-
-	//Print WAV header
-	/*
-	cout << "WAV File Header read:" << endl;
-	cout << "File Type: " << header.chunkID << endl;
-	cout << "File Size: " << header.chunkSize << endl;
-	cout << "WAV Marker: " << header.format << endl;
-	cout << "Format Name: " << header.subchunk1ID << endl;
-	cout << "Format Length: " << header.subchunk1Size << endl;
-	cout << "Format Type: " << header.audioFormat << endl;
-	cout << "Number of Channels: " << header.numChannels << endl;
-	cout << "Sample Rate: " << header.sampleRate << endl;
-	cout << "Sample Rate * Bits/Sample * Channels / 8: " << header.byteRate << endl;
-	cout << "Bits per Sample * Channels / 8.1: " << header.blockAlign << endl;
-	cout << "Bits per Sample: " << header.bitsPerSample << endl;
-	*/
+	if (!fin || memcmp(header.chunkID, "RIFF", 4) || memcmp(header.format, "WAVE", 4))
+		throw std::runtime_error("WavAudioStream: not a wav file");
+	if (header.numChannels != channels)
+		throw std::runtime_error("WavAudioStream: only stereo wav files are supported");
+	const bool is_pcm16 = header.audioFormat == WAV_FORMAT_PCM && header.bitsPerSample == 16;
+	const bool is_float = header.audioFormat == WAV_FORMAT_IEEE_FLOAT && header.bitsPerSample == 32;
+	if (!is_pcm16 && !is_float)
+		throw std::runtime_error("WavAudioStream: only 16 bit pcm and 32 bit float wav files are supported");
 	sample_rate = header.sampleRate;
 
+	//Skip the rest of the fmt chunk
+	fin.seekg(header.subchunk1Size - 16, ios::cur);
+
 	//Reading file
 	chunk_t chunk;
 	//go to data chunk
 	while (true) {
 		fin.read((char*)&chunk, sizeof(chunk));
-		if (*(unsigned int *)&chunk.ID == 0x61746164)
+		if (!fin)
+			throw std::runtime_error("WavAudioStream: wav file has no data chunk");
+		if (memcmp(chunk.ID, "data", 4) == 0)
 			break;
 		//skip chunk data bytes
 		fin.seekg(chunk.size, ios::cur);
 	}
 
 	//Number of samples
-	int sample_size = header.bitsPerSample / 8;
-	int samples_count = chunk.size * 8 / header.bitsPerSample;
+	const int sample_size = header.bitsPerSample / 8;
+	const int samples_count = chunk.size / sample_size;
+	frames_count = samples_count / channels;
 
-	buf_interlaced = new short[samples_count];
-	memset(buf_interlaced, 0, sizeof(short) * samples_count);
+	buf_interlaced = new float[samples_count];
 
 	//Reading data
-	for (int i = 0; i < samples_count; ++i) {
-		fin.read((char*)&buf_interlaced[i], sample_size);
+	if (is_float) {
+		fin.read((char*)buf_interlaced, samples_count * sizeof(float));
+	}
+	else {
+		vector<short> samples(samples_count);
+		fin.read((char*)samples.data(), samples_count * sizeof(short));
+		for (int i = 0; i < samples_count; ++i)
+			buf_interlaced[i] = samples[i] / 32768.f;
 	}
 
 	// TODO do not load the whole file to memory
@@ -97,9 +91,32 @@ WavAudioStream::~WavAudioStream() {
 }
 
 void WavAudioStream::get_next_pcm(float * buff_l, float * buff_r, int buff_size) {
-	// TODO
-	cout << "WavAudioStream.get_next_pcm not implemented yet" << endl;
-	exit(1);
+	if (realtime) {
+		if (frames_read == 0)
+			start_time = std::chrono::steady_clock::now();
+		// Wait until the last frame of this block would have been played
+		const auto frames_end = std::chrono::microseconds(int64_t(frames_read + buff_size) * 1000000 / sample_rate);
+		std::this_thread::sleep_until(start_time + frames_end);
+	}
+
+	// Output silence once the file is over
+	int i = 0;
+	for (; i < buff_size && frames_read < frames_count; ++i, ++frames_read) {
+		buff_l[i] = buf_interlaced[frames_read * channels + 0];
+		buff_r[i] = buf_interlaced[frames_read * channels + 1];
+	}
+	std::fill(buff_l + i, buff_l + buff_size, 0.f);
+	std::fill(buff_r + i, buff_r + buff_size, 0.f);
+}
+
+bool WavAudioStream::at_end() {
+	return frames_read >= frames_count;
+}
+
+int WavAudioStream::get_available_pcm(float * buff_l, float * buff_r, int max_frames, std::chrono::steady_clock::time_point& capture_time) {
+	// A file has no backlog, get_next_pcm already delivers frames as fast as they are asked for.
+	capture_time = std::chrono::steady_clock::now();
+	return 0;
 }
 
 int WavAudioStream::get_sample_rate() {
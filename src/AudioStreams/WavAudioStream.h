@@ -1,16 +1,29 @@
+#pragma once
+
 #include "AudioStream.h"
 
 #include "filesystem.h"
 
 class WavAudioStream : public AudioStream {
 public:
-	WavAudioStream(const filesys::path & wav_path);
+	// Reads .wav files, or headerless interleaved stereo 48000hz float files if the extension is .f32
+	// realtime: if true get_next_pcm blocks so that frames are delivered at the file's sample rate
+	WavAudioStream(const filesys::path & wav_path, bool realtime = false);
 	~WavAudioStream();
 	void get_next_pcm(float* buff_l, float* buff_r, int buff_size);
+	int get_available_pcm(float* buff_l, float* buff_r, int max_frames, std::chrono::steady_clock::time_point& capture_time);
 	int get_sample_rate();
 	int get_max_buff_size();
+	// Whether every frame in the file has been read
+	bool at_end();
 private:
 	int sample_rate;
 	const int max_buff_size = 512;
-	short* buf_interlaced;
+	const int channels = 2;
+	float* buf_interlaced;
+	int frames_count;
+	int frames_read;
+
+	bool realtime;
+	std::chrono::steady_clock::time_point start_time;
 };
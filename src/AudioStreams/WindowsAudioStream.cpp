@@ -131,6 +131,55 @@ void WindowsAudioStream::get_next_pcm(float * buff_l, float * buff_r, int buff_s
     }
 }
 
+int WindowsAudioStream::get_available_pcm(float * buff_l, float * buff_r, int max_frames, std::chrono::steady_clock::time_point& capture_time) {
+    const int channels = 2;
+
+	UINT32 packetLength = 0;
+
+	short* pData;
+	DWORD flags;
+	UINT32 numFramesAvailable;
+
+	// Same as get_next_pcm except we stop as soon as the system has no more packets for us
+	int i = 0;
+	if (frame_cache_fill) {
+		int read = frame_cache_fill > max_frames ? max_frames : frame_cache_fill;
+		for (; i < read; i++) {
+			buff_l[i] = frame_cache[i * channels + 0]/32768.f;
+			buff_r[i] = frame_cache[i * channels + 1]/32768.f;
+		}
+		frame_cache_fill -= read;
+		memcpy(frame_cache, frame_cache + channels*read, sizeof(short)*channels*frame_cache_fill);
+	}
+
+    while (i < max_frames) {
+        CHECK(m_pCaptureClient->GetNextPacketSize(&packetLength));
+        if (packetLength == 0)
+            break;
+
+        CHECK(m_pCaptureClient->GetBuffer((BYTE**)&pData, &numFramesAvailable, &flags, NULL, NULL));
+        int j = 0;
+        for (; i + j < max_frames && j < numFramesAvailable; j++) {
+            buff_l[i + j] = pData[j * channels + 0] / 32768.f;
+            buff_r[i + j] = pData[j * channels + 1] / 32768.f;
+        }
+        i += j;
+        if (j != numFramesAvailable) {
+            if (frame_cache_fill + (numFramesAvailable - j) >= CACHE_SIZE) {
+                cout << "WindowsAudioStream::get_available_pcm fifo overflow" << endl;
+                exit(-1);
+            }
+            memcpy(frame_cache + channels * frame_cache_fill, pData + j * channels, sizeof(short)*channels*(numFramesAvailable - j));
+            frame_cache_fill += numFramesAvailable - j;
+        }
+        CHECK(m_pCaptureClient->ReleaseBuffer(numFramesAvailable));
+    }
+
+    // The last frame we read was just captured
+    capture_time = chrono::steady_clock::now() - chrono::microseconds(int64_t(i) * 1000000 / sample_rate);
+    return i;
+}
+
 int WindowsAudioStream::get_sample_rate() {
 	return sample_rate;
 }
@@ -12,6 +12,7 @@ public:
 	WindowsAudioStream();
 	~WindowsAudioStream();
 	void get_next_pcm(float* buff_l, float* buff_r, int buff_size);
+	int get_available_pcm(float* buff_l, float* buff_r, int max_frames, std::chrono::steady_clock::time_point& capture_time);
 	int get_sample_rate();
 	int get_max_buff_size();
 
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+// https://github.com/tkaczenko/WavReader/blob/master/WavReader/WavReader.cpp
+// Fixed width fields so the layout matches the file on every platform.
+struct wav_header_t {
+	char chunkID[4]; //"RIFF" = 0x46464952
+	uint32_t chunkSize; //28 [+ sizeof(wExtraFormatBytes) + wExtraFormatBytes] + sum(sizeof(chunk.id) + sizeof(chunk.size) + chunk.size)
+	char format[4]; //"WAVE" = 0x45564157
+	char subchunk1ID[4]; //"fmt " = 0x20746D66
+	uint32_t subchunk1Size; //16 [+ sizeof(wExtraFormatBytes) + wExtraFormatBytes]
+	uint16_t audioFormat;
+	uint16_t numChannels;
+	uint32_t sampleRate;
+	uint32_t byteRate;
+	uint16_t blockAlign;
+	uint16_t bitsPerSample;
+	//[WORD wExtraFormatBytes;]
+	//[Extra format bytes]
+};
+
+//Chunks
+struct chunk_t {
+	char ID[4]; //"data" = 0x61746164
+	uint32_t size;  //Chunk data bytes
+};
+
+static const uint16_t WAV_FORMAT_PCM = 1;
+static const uint16_t WAV_FORMAT_IEEE_FLOAT = 3;
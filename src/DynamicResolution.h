@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+// Picks the scale that window sized buffers and the image are rendered at so that the gpu time of a
+// frame stays under a budget. Rendering cost is roughly proportional to the number of pixels, that is
+// to scale squared, so the scale is moved by the square root of the ratio of budget and measured time.
+//
+// The scale only takes values that are multiples of STEP and is only changed after SETTLE_FRAMES
+// frames at the current scale, because every change reallocates the textures of window sized buffers.
+class DynamicResolution {
+public:
+    DynamicResolution(bool enabled = false, float target_ms = 14.f, float min_scale = .5f)
+        : enabled(enabled), target_ms(target_ms), min_scale(min_scale), scale(1.f), gpu_ms(0.f), measured(false), frames_at_scale(0) {}
+
+    // Adds the measured gpu time of a frame. Returns true if the scale changed.
+    bool add_frame(float frame_gpu_ms) {
+        gpu_ms = measured ? gpu_ms + SMOOTHING * (frame_gpu_ms - gpu_ms) : frame_gpu_ms;
+        measured = true;
+        if (!enabled || ++frames_at_scale < SETTLE_FRAMES)
+            return false;
+
+        const float wanted = scale * std::sqrt(target_ms / std::max(gpu_ms, .01f));
+        float new_scale = scale;
+        if (gpu_ms > target_ms)
+            new_scale = std::floor(wanted / STEP) * STEP;
+        else if (gpu_ms < HEADROOM * target_ms)
+            // Grow one step at a time so a frame that was cheap by chance doesn't overshoot the budget
+            new_scale = std::min(std::floor(wanted / STEP) * STEP, scale + STEP);
+        new_scale = std::max(min_scale, std::min(1.f, new_scale));
+
+        if (new_scale == scale)
+            return false;
+        scale = new_scale;
+        frames_at_scale = 0;
+        // Start measuring the new scale from scratch
+        measured = false;
+        return true;
+    }
+
+    float get_scale() const {
+        return scale;
+    }
+    // Smoothed gpu time per frame in milliseconds
+    float get_gpu_ms() const {
+        return gpu_ms;
+    }
+
+private:
+    static constexpr float STEP = 1.f / 16.f;
+    static constexpr float SMOOTHING = .1f;
+    // Only grow while the frame takes less than this fraction of the budget
+    static constexpr float HEADROOM = .8f;
+    static const int SETTLE_FRAMES = 30;
+
+    bool enabled;
+    float target_ms;
+    float min_scale;
+    float scale;
+    float gpu_ms;
+    bool measured;
+    int frames_at_scale;
+};
@@ -2,56 +2,78 @@
 
 #include <string>
 #include <chrono>
+#include <set>
+#include <map>
+#include <mutex>
 
 #include "filesystem.h"
 
+// Changes to shader.json, frag and geom files and the glsl files they include trigger a reload
+inline bool is_shader_file(const filesys::path& path) {
+	const std::string extension = path.extension().string();
+	return extension == ".json" || extension == ".geom" || extension == ".frag" || extension == ".glsl";
+}
+
+#ifdef LINUX
+#include "InotifyFileWatcher.h"
+using FileWatcher = InotifyFileWatcher;
+#else
 #include "FileWatcher/FileWatcher.h"
 
 class FileWatcher : FW::FileWatchListener {
 public:
-	FileWatcher(filesys::path shader_folder) : shader_folder(shader_folder), shaders_changed(false), last_event_time()
+	FileWatcher(filesys::path shader_folder) : shader_folder(shader_folder)
 	{
-		file_watcher.addWatch(shader_folder.string(), (FW::FileWatchListener*)this, false);
+		file_watcher.addWatch(shader_folder.string(), (FW::FileWatchListener*)this, true);
 	}
 
 	~FileWatcher() {
 		file_watcher.removeWatch(shader_folder.string());
 	}
 
-	// More than one event can be delivered by the editor from a single save command.
-	// So sleep a few millis and then process the event and set the last process time.
-	// If new event is within 100 ms of last process time, then ignore it.
-	// If shader.json or any frag or geom file has changed, then set shaders_changed.
+	// More than one event can be delivered by the editor from a single save command,
+	// so only the time of the latest event is kept and the file is reported once
+	// no event has arrived for it for DEBOUNCE_MS.
 	void handleFileAction(FW::WatchID watchid, const FW::String& dir, const FW::String& filename_str, FW::Action action)
 	{
 		if (FW::Action::Delete == action)
 			return;
-		if (dir != "shaders")
-			return;
-		std::string extension = filesys::path(filename_str).extension().string();
-		if (extension != ".json" && extension != ".geom" && extension != ".frag")
+		// The filename is relative to the watched folder and includes subfolders
+		const filesys::path path(filename_str);
+		if (!is_shader_file(path))
 			return;
-		if (std::chrono::steady_clock::now() - last_event_time < std::chrono::milliseconds(100))
-			return;
-
-		std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-		shaders_changed = true;
-		last_event_time = std::chrono::steady_clock::now();
+		std::lock_guard<std::mutex> lock(mtx);
+		changed_files[path.generic_string()] = std::chrono::steady_clock::now();
 	}
 
 	bool files_changed() {
-		if (shaders_changed) {
-			shaders_changed = false;
-			return true;
+		return !take_changed_files().empty();
+	}
+
+	// Paths relative to the shader folder of the shader files that changed since the last call
+	std::set<std::string> take_changed_files() {
+		std::set<std::string> files;
+		const auto settled = std::chrono::steady_clock::now() - std::chrono::milliseconds(DEBOUNCE_MS);
+		std::lock_guard<std::mutex> lock(mtx);
+		for (auto it = changed_files.begin(); it != changed_files.end();) {
+			if (it->second < settled) {
+				files.insert(it->first);
+				it = changed_files.erase(it);
+			}
+			else
+				++it;
 		}
-		return false;
+		return files;
 	}
 
 private:
-	bool shaders_changed;
-	std::chrono::steady_clock::time_point last_event_time;
+	static const int DEBOUNCE_MS = 100;
+
+	// Written by the watcher's thread and read by the render loop, with the time of the latest event
+	std::mutex mtx;
+	std::map<std::string, std::chrono::steady_clock::time_point> changed_files;
 
 	filesys::path shader_folder;
 	FW::AsyncFileWatcher file_watcher;
 };
+#endif
@@ -0,0 +1,155 @@
+#include <stdexcept>
+using std::runtime_error;
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include "FrameExporter.h"
+
+#ifdef WINDOWS
+#define popen _popen
+#define pclose _pclose
+#endif
+
+FrameExporter::FrameExporter(const std::string& path, Format format, int width, int height, int fps, int tile_size)
+    : format(format), width(width), height(height), frames_captured(0), frames_written(0) {
+    // A Y4M frame is stored plane after plane, so no row can be written before the whole frame is known
+    if (tile_size && format == Format::Y4M)
+        throw runtime_error("FrameExporter: Y4M can't be written in tiles, export tiled frames as rgba or pam");
+    is_pipe = !path.empty() && path[0] == '|';
+    file = is_pipe ? popen(path.substr(1).c_str(), "w") : fopen(path.c_str(), "wb");
+    if (!file)
+        throw runtime_error("FrameExporter: could not open " + path + " for writing");
+
+    for (int i = 0; i < PBO_COUNT; ++i) {
+        pbos[i] = 0;
+        fences[i] = nullptr;
+    }
+    if (tile_size) {
+        band.resize(size_t(4) * width * tile_size);
+        return;
+    }
+
+    if (format == Format::Y4M) {
+        // BT.601 limited range, which is what players assume for Y4M without further tags
+        fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444 XCOLORRANGE=LIMITED\n", width, height, fps);
+        frame.resize(3 * width * height);
+    }
+    else {
+        frame.resize(4 * width * height);
+    }
+
+    glGenBuffers(PBO_COUNT, pbos);
+    for (int i = 0; i < PBO_COUNT; ++i) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 4 * width * height, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+FrameExporter::~FrameExporter() {
+    finish();
+    for (GLsync fence : fences)
+        if (fence)
+            glDeleteSync(fence);
+    glDeleteBuffers(PBO_COUNT, pbos);
+    if (is_pipe)
+        pclose(file);
+    else
+        fclose(file);
+}
+
+void FrameExporter::capture(GLuint fbo) {
+    // Every pbo is in flight, make room by writing the oldest frame
+    if (frames_captured - frames_written == PBO_COUNT)
+        write_oldest();
+
+    const int i = frames_captured % PBO_COUNT;
+    // The renderer leaves its output framebuffer bound, so for it this doesn't change any state
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    // With a pack buffer bound this only queues the copy
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frames_captured++;
+
+    // Keep PBO_COUNT - 1 frames in flight
+    if (frames_captured - frames_written == PBO_COUNT)
+        write_oldest();
+    if (ferror(file))
+        throw runtime_error("FrameExporter: writing a frame failed");
+}
+
+void FrameExporter::finish() {
+    while (frames_written < frames_captured)
+        write_oldest();
+    fflush(file);
+}
+
+void FrameExporter::write_oldest() {
+    const int i = frames_written % PBO_COUNT;
+    // Usually long signaled, the wait only blocks while draining at the end
+    glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    glDeleteSync(fences[i]);
+    fences[i] = nullptr;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+    const auto* rgba = static_cast<const unsigned char*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 4 * width * height, GL_MAP_READ_BIT));
+    if (rgba) {
+        write_frame(rgba);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    frames_written++;
+}
+
+void FrameExporter::write_frame(const unsigned char* rgba) {
+    // OpenGL's rows start at the bottom, video rows at the top
+    if (format != Format::Y4M) {
+        if (format == Format::PAM)
+            write_pam_header();
+        const int row_size = 4 * width;
+        for (int y = 0; y < height; ++y)
+            std::memcpy(frame.data() + y * row_size, rgba + (height - 1 - y) * row_size, row_size);
+    }
+    else {
+        unsigned char* Y = frame.data();
+        unsigned char* U = Y + width * height;
+        unsigned char* V = U + width * height;
+        for (int y = 0; y < height; ++y) {
+            const unsigned char* src = rgba + (height - 1 - y) * 4 * width;
+            for (int x = 0; x < width; ++x, src += 4) {
+                const float r = src[0], g = src[1], b = src[2];
+                const int o = y * width + x;
+                Y[o] = (unsigned char)std::lround(16.f + .257f * r + .504f * g + .098f * b);
+                U[o] = (unsigned char)std::lround(128.f - .148f * r - .291f * g + .439f * b);
+                V[o] = (unsigned char)std::lround(128.f + .439f * r - .368f * g - .071f * b);
+            }
+        }
+        fputs("FRAME\n", file);
+    }
+    fwrite(frame.data(), 1, frame.size(), file);
+}
+
+void FrameExporter::add_tile(int x, int y, int tile_width, int tile_height, const unsigned char* rgba) {
+    if (x == 0 && y + tile_height == height && format == Format::PAM)
+        write_pam_header();
+
+    const int row_size = 4 * width;
+    for (int row = 0; row < tile_height; ++row)
+        std::memcpy(band.data() + (tile_height - 1 - row) * row_size + 4 * x, rgba + row * 4 * tile_width, 4 * tile_width);
+
+    if (x + tile_width == width) {
+        fwrite(band.data(), 1, size_t(row_size) * tile_height, file);
+        if (y == 0)
+            frames_written++;
+    }
+    if (ferror(file))
+        throw runtime_error("FrameExporter: writing a frame failed");
+}
+
+void FrameExporter::write_pam_header() {
+    fprintf(file, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", width, height);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <cstdio>
+#include <string>
+#include <GL/glew.h>
+
+// Streams rendered frames to a file, or to a command's stdin if the path starts with '|'.
+// Frames are written as raw RGBA8, as a Y4M (YUV 4:4:4) video or as a sequence of PAM images, top row first.
+//
+// Reading a framebuffer back with glReadPixels into client memory waits for the gpu to finish the
+// frame. Instead each frame is copied into one of a ring of pixel pack buffers and only mapped
+// PBO_COUNT - 1 frames later, when the copy has long completed, so the gpu keeps rendering ahead.
+class FrameExporter {
+public:
+    enum class Format { RGBA, Y4M, PAM };
+
+    // tile_size: if not 0 frames are passed in tiles through add_tile instead of read back by capture
+    FrameExporter(const std::string& path, Format format, int width, int height, int fps, int tile_size = 0);
+    // Writes the frames that are still in flight and closes the output
+    ~FrameExporter();
+
+    // Starts reading back the width x height image in framebuffer fbo, and writes the oldest frame in flight
+    void capture(GLuint fbo);
+    // Writes every frame in flight
+    void finish();
+    // Adds a tile of a frame in the order Renderer::render_tiled renders them, writing each band of rows
+    // as soon as its last tile is added, so only a band of the frame is ever in memory
+    void add_tile(int x, int y, int tile_width, int tile_height, const unsigned char* rgba);
+
+    int get_frames_written() const {
+        return frames_written;
+    }
+
+private:
+    FrameExporter(FrameExporter&) = delete;
+    FrameExporter& operator=(FrameExporter&) = delete;
+
+    static const int PBO_COUNT = 3;
+
+    Format format;
+    int width;
+    int height;
+    FILE* file;
+    bool is_pipe;
+
+    GLuint pbos[PBO_COUNT];
+    GLsync fences[PBO_COUNT];
+    long long frames_captured;
+    long long frames_written;
+
+    // Frame converted to the output format
+    std::vector<unsigned char> frame;
+    // Rows of the band of tiles being added, top row first
+    std::vector<unsigned char> band;
+
+    void write_oldest();
+    void write_frame(const unsigned char* rgba);
+    void write_pam_header();
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <GL/glew.h>
+
+// Remembers the gl state the renderer sets so that calls which would not change it are skipped,
+// and counts the gl calls that are issued each frame.
+//
+// Only state set through this class is tracked. After gl calls are made around it, for example by
+// constructing a renderer or linking programs, call invalidate() so the next call of each kind is issued.
+class GLState {
+public:
+    static const int MAX_TEXTURE_UNITS = 32;
+
+    GLState() {
+        invalidate();
+        calls = 0;
+        last_frame_calls = 0;
+    }
+
+    void invalidate() {
+        program = UNKNOWN;
+        framebuffer = UNKNOWN;
+        viewport_size = {-1, -1};
+        clear_color_known = false;
+        active_unit = -1;
+        for (Binding& b : textures)
+            b = {0, UNKNOWN};
+        for (Binding& b : buffers)
+            b = {0, UNKNOWN};
+    }
+
+    // Starts counting the calls of a new frame
+    void begin_frame() {
+        last_frame_calls = calls;
+        calls = 0;
+    }
+    int get_last_frame_calls() const {
+        return last_frame_calls;
+    }
+
+    void use_program(GLuint p) {
+        if (p != program) {
+            glUseProgram(p);
+            program = p;
+            calls++;
+        }
+    }
+
+    void bind_framebuffer(GLuint fbo) {
+        if (fbo != framebuffer) {
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            framebuffer = fbo;
+            calls++;
+        }
+    }
+
+    void viewport(int width, int height) {
+        if (viewport_size[0] != width || viewport_size[1] != height) {
+            glViewport(0, 0, width, height);
+            viewport_size = {width, height};
+            calls++;
+        }
+    }
+
+    void clear_color(float r, float g, float b, float a) {
+        const std::array<float, 4> c = {r, g, b, a};
+        if (!clear_color_known || c != clear_color_value) {
+            glClearColor(r, g, b, a);
+            clear_color_value = c;
+            clear_color_known = true;
+            calls++;
+        }
+    }
+
+    void active_texture(int unit) {
+        if (unit != active_unit) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            active_unit = unit;
+            calls++;
+        }
+    }
+
+    // Binds tex to target in the texture unit, leaving the unit active. unit must be below MAX_TEXTURE_UNITS.
+    void bind_texture(int unit, GLenum target, GLuint tex) {
+        if (unit < 0 || unit >= MAX_TEXTURE_UNITS)
+            throw std::runtime_error("GLState: texture unit " + std::to_string(unit) + " isn't tracked");
+        active_texture(unit);
+        Binding& b = textures[unit];
+        if (b.target != target || b.name != tex) {
+            glBindTexture(target, tex);
+            b = {target, tex};
+            calls++;
+        }
+    }
+
+    // Only GL_PIXEL_UNPACK_BUFFER and GL_UNIFORM_BUFFER are tracked
+    void bind_buffer(GLenum target, GLuint buffer) {
+        Binding& b = buffers[buffer_index(target)];
+        if (b.name != buffer) {
+            glBindBuffer(target, buffer);
+            b.name = buffer;
+            calls++;
+        }
+    }
+
+    // Binds a range of a uniform buffer to an indexed binding point, which also binds it to GL_UNIFORM_BUFFER
+    void bind_buffer_range(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+        buffers[buffer_index(GL_UNIFORM_BUFFER)].name = buffer;
+        calls++;
+    }
+    void bind_buffer_base(GLuint index, GLuint buffer) {
+        glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer);
+        buffers[buffer_index(GL_UNIFORM_BUFFER)].name = buffer;
+        calls++;
+    }
+
+    // Issues a gl call that is not cached and counts it, for example call(glClear, GL_COLOR_BUFFER_BIT)
+    template <typename F, typename... Args>
+    auto call(F f, Args... args) {
+        calls++;
+        return f(args...);
+    }
+
+private:
+    static const GLuint UNKNOWN = ~GLuint(0);
+
+    struct Binding {
+        GLenum target;
+        GLuint name;
+    };
+
+    static int buffer_index(GLenum target) {
+        return target == GL_UNIFORM_BUFFER ? 1 : 0;
+    }
+
+    GLuint program;
+    GLuint framebuffer;
+    std::array<int, 2> viewport_size;
+    std::array<float, 4> clear_color_value;
+    bool clear_color_known;
+    int active_unit;
+    std::array<Binding, MAX_TEXTURE_UNITS> textures;
+    std::array<Binding, 2> buffers;
+
+    int calls;
+    int last_frame_calls;
+};
@@ -0,0 +1,169 @@
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <stdexcept>
+using std::runtime_error;
+#include <string>
+using std::string;
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include "FileWatcher.h"
+#include "InotifyFileWatcher.h"
+
+static const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR;
+
+InotifyFileWatcher::InotifyFileWatcher(const filesys::path& shader_folder)
+    : shader_folder(shader_folder), head(0), tail(0) {
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotify_fd < 0 || timer_fd < 0 || wake_fd < 0)
+        throw runtime_error(string("Failed to create the shader file watcher: ") + strerror(errno));
+
+    add_watches(filesys::path());
+    if (watches.empty())
+        throw runtime_error("Failed to watch " + shader_folder.string() + " for changes");
+    // Files found while adding the initial watches aren't changes
+    pending.clear();
+
+    watcher_thread = std::thread(&InotifyFileWatcher::watcher_loop, this);
+}
+
+InotifyFileWatcher::~InotifyFileWatcher() {
+    const uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) != sizeof(one))
+        cout << "Failed to stop the shader file watcher" << endl;
+    watcher_thread.join();
+    close(wake_fd);
+    close(timer_fd);
+    close(inotify_fd);
+}
+
+std::set<string> InotifyFileWatcher::take_changed_files() {
+    std::set<string> files;
+    const uint32_t t = tail.load(std::memory_order_relaxed);
+    const uint32_t h = head.load(std::memory_order_acquire);
+    if (t == h)
+        return files;
+    for (uint32_t i = t; i != h; ++i) {
+        std::unique_ptr<std::set<string>>& batch = queue[i % QUEUE_SIZE];
+        files.insert(batch->begin(), batch->end());
+        batch.reset();
+    }
+    tail.store(h, std::memory_order_release);
+    return files;
+}
+
+void InotifyFileWatcher::add_watches(const filesys::path& dir) {
+    const filesys::path full_path = shader_folder / dir;
+    const int wd = inotify_add_watch(inotify_fd, full_path.c_str(), WATCH_MASK);
+    if (wd < 0) {
+        cout << "Failed to watch " << full_path.string() << ": " << strerror(errno) << endl;
+        return;
+    }
+    watches[wd] = dir;
+
+    // A new folder may already have files in it by the time its watch is added
+    std::error_code ec;
+    for (filesys::directory_iterator it(full_path, ec), end; !ec && it != end; it.increment(ec)) {
+        const filesys::path name = it->path().filename();
+        if (filesys::is_directory(it->status()))
+            add_watches(dir / name);
+        else if (is_shader_file(name))
+            pending.insert((dir / name).generic_string());
+    }
+}
+
+bool InotifyFileWatcher::read_events() {
+    bool changed = false;
+    alignas(inotify_event) char buf[4096];
+    while (true) {
+        const ssize_t len = read(inotify_fd, buf, sizeof(buf));
+        if (len <= 0)
+            return changed;
+        for (char* p = buf; p < buf + len; p += sizeof(inotify_event) + ((inotify_event*)p)->len) {
+            const inotify_event* event = (const inotify_event*)p;
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were dropped, so reload without knowing which file changed
+                pending.insert(".");
+                changed = true;
+                continue;
+            }
+            auto watch = watches.find(event->wd);
+            if (watch == watches.end())
+                continue;
+            if (event->mask & IN_IGNORED) {
+                watches.erase(watch);
+                continue;
+            }
+            if (event->len == 0)
+                continue;
+            const filesys::path path = watch->second / event->name;
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    const size_t num_pending = pending.size();
+                    add_watches(path);
+                    changed |= pending.size() != num_pending;
+                }
+            }
+            else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                if (is_shader_file(path)) {
+                    pending.insert(path.generic_string());
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+void InotifyFileWatcher::arm_timer() {
+    itimerspec spec = {};
+    spec.it_value.tv_sec = DEBOUNCE_MS / 1000;
+    spec.it_value.tv_nsec = (DEBOUNCE_MS % 1000) * 1000000L;
+    timerfd_settime(timer_fd, 0, &spec, nullptr);
+}
+
+void InotifyFileWatcher::publish() {
+    const uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == QUEUE_SIZE) {
+        // The render loop hasn't taken the earlier batches, try again later
+        arm_timer();
+        return;
+    }
+    queue[h % QUEUE_SIZE] = std::make_unique<std::set<string>>(std::move(pending));
+    pending.clear();
+    head.store(h + 1, std::memory_order_release);
+}
+
+void InotifyFileWatcher::watcher_loop() {
+    pollfd fds[3] = {
+        {wake_fd, POLLIN, 0},
+        {inotify_fd, POLLIN, 0},
+        {timer_fd, POLLIN, 0},
+    };
+    while (true) {
+        if (poll(fds, 3, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            cout << "Shader file watcher failed: " << strerror(errno) << endl;
+            return;
+        }
+        if (fds[0].revents)
+            return;
+        // Restarting the timer on every shader file event makes it expire DEBOUNCE_MS after the last one
+        if (fds[1].revents && read_events())
+            arm_timer();
+        if (fds[2].revents) {
+            uint64_t expirations;
+            if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations) && !pending.empty())
+                publish();
+        }
+    }
+}
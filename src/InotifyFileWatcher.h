@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <set>
+#include <map>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <cstdint>
+
+#include "filesystem.h"
+
+// Watches the shader folder and its subfolders with inotify on a thread of its own.
+//
+// Editors often touch a file several times for one save, so changed paths are collected until no
+// event has arrived for DEBOUNCE_MS, timed by a timerfd, and then published as one batch. Batches go
+// through a single producer single consumer queue, so checking for changes from the render loop is
+// a couple of atomic loads. Shutdown wakes the thread through an eventfd.
+class InotifyFileWatcher {
+public:
+    InotifyFileWatcher(const filesys::path& shader_folder);
+    ~InotifyFileWatcher();
+
+    bool files_changed() {
+        return !take_changed_files().empty();
+    }
+    // Paths relative to the shader folder of the shader files that changed since the last call
+    std::set<std::string> take_changed_files();
+
+private:
+    InotifyFileWatcher(InotifyFileWatcher&) = delete;
+    InotifyFileWatcher& operator=(InotifyFileWatcher&) = delete;
+
+    static const int DEBOUNCE_MS = 100;
+    static const int QUEUE_SIZE = 16;
+
+    filesys::path shader_folder;
+    int inotify_fd;
+    int timer_fd;
+    int wake_fd;
+    // Watched directory of each watch descriptor, relative to the shader folder
+    std::map<int, filesys::path> watches;
+
+    // Only the watcher thread writes head and only the render loop writes tail
+    std::array<std::unique_ptr<std::set<std::string>>, QUEUE_SIZE> queue;
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    // Changes not yet published, only used by the watcher thread
+    std::set<std::string> pending;
+
+    std::thread watcher_thread;
+    void watcher_loop();
+    void add_watches(const filesys::path& dir);
+    // Returns true if a shader file changed
+    bool read_events();
+    void arm_timer();
+    void publish();
+};
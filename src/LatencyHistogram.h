@@ -0,0 +1,77 @@
+#pragma once
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <array>
+#include <vector>
+#include <algorithm>
+
+// Rolling histogram of the most recent latency measurements, bucketed by millisecond.
+// Used to measure how old the audio on screen is when the frame showing it is presented.
+class LatencyHistogram {
+public:
+    LatencyHistogram(int window_size = 600) : samples(window_size, 0), next(0), count(0) {
+        bins.fill(0);
+    }
+
+    void add(std::chrono::steady_clock::duration latency) {
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(latency).count();
+        const int bin = int(std::max<long long>(0, std::min<long long>(ms, NUM_BINS - 1)));
+        if (count == int(samples.size()))
+            bins[samples[next]]--;
+        else
+            count++;
+        samples[next] = bin;
+        bins[bin]++;
+        next = (next + 1) % samples.size();
+    }
+
+    int size() const {
+        return count;
+    }
+
+    // Returns the latency in milliseconds that p percent of the window is at or below
+    int percentile(float p) const {
+        const int target = std::max(1, int(count * p / 100.f + .5f));
+        int seen = 0;
+        for (int i = 0; i < NUM_BINS; ++i) {
+            seen += bins[i];
+            if (seen >= target)
+                return i;
+        }
+        return NUM_BINS - 1;
+    }
+
+    void report(std::ostream& os) const {
+        if (count == 0)
+            return;
+        os << "Audio to screen latency over the last " << count << " frames (ms): "
+           << "p50 " << percentile(50) << ", p95 " << percentile(95) << ", p99 " << percentile(99)
+           << ", max " << percentile(100) << "\n";
+
+        // Print the histogram in 10 ms rows
+        const int row_width = 10;
+        const int bar_width = 40;
+        for (int row = 0; row < NUM_BINS; row += row_width) {
+            int row_count = 0;
+            for (int i = row; i < row + row_width && i < NUM_BINS; ++i)
+                row_count += bins[i];
+            if (row_count == 0)
+                continue;
+            os << std::setw(4) << row << "-" << std::setw(3) << row + row_width - 1 << " | "
+               << std::string(std::max(1, row_count * bar_width / count), '#') << " " << row_count << "\n";
+        }
+        os << std::flush;
+    }
+
+private:
+    // The last bin also counts every latency larger than NUM_BINS - 1 ms
+    static const int NUM_BINS = 250;
+    std::array<int, NUM_BINS> bins;
+
+    // ring of the bins of the most recent measurements, so old measurements can be removed
+    std::vector<int> samples;
+    int next;
+    int count;
+};
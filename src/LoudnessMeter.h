@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+// Measures the loudness of the captured audio. Meant to be fed every frame of 48000hz audio in
+// capture order, because the K-weighting filters need contiguous audio.
+//
+// rms: root mean square of both channels
+// loudness: ITU-R BS.1770 loudness (K-weighted, in LUFS) without gating
+// momentary values cover the last 400ms and short term values the last 3s
+// true peak: largest absolute value of the audio upsampled 4x, so that peaks between samples are seen
+class LoudnessMeter {
+public:
+    LoudnessMeter() {
+        // Windowed sinc interpolation filter split into one filter per upsampling phase
+        const int L = PHASES * TAPS;
+        const float c = (L - 1) / 2.f;
+        for (int p = 0; p < PHASES; ++p) {
+            float sum = 0.f;
+            for (int j = 0; j < TAPS; ++j) {
+                const float x = (j * PHASES + p - c) / PHASES;
+                const float sinc = std::sin(3.1415926f * x) / (3.1415926f * x);
+                const float window = .5f - .5f * std::cos(2.f * 3.1415926f * (j * PHASES + p + .5f) / L);
+                interp[p][j] = sinc * window;
+                sum += interp[p][j];
+            }
+            for (int j = 0; j < TAPS; ++j)
+                interp[p][j] /= sum;
+        }
+        reset();
+    }
+
+    void reset() {
+        for (Channel& c : channels)
+            c = Channel();
+        std::fill(block_sq, block_sq + NUM_BLOCKS, 0.f);
+        std::fill(block_ksq, block_ksq + NUM_BLOCKS, 0.f);
+        block = 0;
+        block_fill = 0;
+        blocks_done = 0;
+        sq = 0.f;
+        ksq = 0.f;
+    }
+
+    void process(const float* buff_l, const float* buff_r, int size) {
+        for (int i = 0; i < size; ++i) {
+            const float x[2] = {buff_l[i], buff_r[i]};
+            for (int ch = 0; ch < 2; ++ch) {
+                Channel& c = channels[ch];
+                sq += x[ch] * x[ch];
+                const float k = c.stage2.filter(c.stage1.filter(x[ch]));
+                ksq += k * k;
+
+                c.history[c.history_i] = x[ch];
+                c.history_i = (c.history_i + 1) % TAPS;
+                for (int p = 0; p < PHASES; ++p) {
+                    float y = 0.f;
+                    for (int j = 0; j < TAPS; ++j)
+                        y += interp[p][j] * c.history[(c.history_i + TAPS - 1 - j) % TAPS];
+                    c.peak = std::max(c.peak, std::abs(y));
+                }
+                c.peak = std::max(c.peak, std::abs(x[ch]));
+            }
+
+            if (++block_fill == BLOCK_LEN) {
+                block_sq[block] = sq;
+                block_ksq[block] = ksq;
+                block = (block + 1) % NUM_BLOCKS;
+                blocks_done = std::min(blocks_done + 1, NUM_BLOCKS);
+                block_fill = 0;
+                sq = 0.f;
+                ksq = 0.f;
+            }
+        }
+    }
+
+    float momentary_rms() const {
+        return std::sqrt(mean_square(block_sq, MOMENTARY_BLOCKS) / 2.f);
+    }
+    float short_term_rms() const {
+        return std::sqrt(mean_square(block_sq, NUM_BLOCKS) / 2.f);
+    }
+    float momentary_loudness() const {
+        return to_lufs(mean_square(block_ksq, MOMENTARY_BLOCKS));
+    }
+    float short_term_loudness() const {
+        return to_lufs(mean_square(block_ksq, NUM_BLOCKS));
+    }
+
+    // Returns the true peak of a channel since the last call and starts a new measurement
+    float take_peak(int ch) {
+        const float p = channels[ch].peak;
+        channels[ch].peak = 0.f;
+        return p;
+    }
+
+private:
+    // Biquad in direct form 1
+    struct Biquad {
+        float b0, b1, b2, a1, a2;
+        float x1 = 0.f, x2 = 0.f, y1 = 0.f, y2 = 0.f;
+        float filter(float x) {
+            const float y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            return y;
+        }
+    };
+
+    static const int PHASES = 4;
+    static const int TAPS = 8;
+    float interp[PHASES][TAPS];
+
+    struct Channel {
+        // K-weighting coefficients for 48000hz from ITU-R BS.1770
+        Biquad stage1 = {1.53512485958697f, -2.69169618940638f, 1.19839281085285f, -1.69065929318241f, .73248077421585f};
+        Biquad stage2 = {1.f, -2.f, 1.f, -1.99004745483398f, .99007225036621f};
+        float history[TAPS] = {0};
+        int history_i = 0;
+        float peak = 0.f;
+    };
+    Channel channels[2];
+
+    // Sums of squares are kept for 100ms blocks, the last NUM_BLOCKS of which cover 3 seconds
+    static const int BLOCK_LEN = 4800;
+    static const int NUM_BLOCKS = 30;
+    static const int MOMENTARY_BLOCKS = 4;
+    float block_sq[NUM_BLOCKS];
+    float block_ksq[NUM_BLOCKS];
+    int block;
+    int block_fill;
+    int blocks_done;
+    float sq;
+    float ksq;
+
+    // Mean square per channel summed over both channels, over the last n blocks
+    float mean_square(const float* blocks, int n) const {
+        n = std::min(n, blocks_done);
+        if (n == 0)
+            return 0.f;
+        float sum = 0.f;
+        for (int i = 1; i <= n; ++i)
+            sum += blocks[(block + NUM_BLOCKS - i) % NUM_BLOCKS];
+        return sum / (n * BLOCK_LEN);
+    }
+
+    static float to_lufs(float mean_square) {
+        return -.691f + 10.f * std::log10(std::max(mean_square, 1e-10f));
+    }
+};
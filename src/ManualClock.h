@@ -0,0 +1,27 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// A clock that only moves when it is advanced. Lets AudioProcess run on the timeline of a file
+// rather than the wall clock, for example when exporting a video faster or slower than realtime.
+class ManualClock {
+public:
+    typedef int64_t rep;
+    typedef std::nano period;
+    typedef std::chrono::duration<rep, period> duration;
+    typedef std::chrono::time_point<ManualClock> time_point;
+    static const bool is_steady = true;
+
+    static time_point now() noexcept {
+        return current;
+    }
+    static void advance(duration d) noexcept {
+        current += d;
+    }
+
+private:
+    ManualClock() = delete;
+
+    static inline time_point current;
+};
@@ -0,0 +1,431 @@
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <algorithm>
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+#include <stdexcept>
+using std::runtime_error;
+#include <cstdlib>
+#include <chrono>
+using ClockT = std::chrono::steady_clock;
+
+#include "Playlist.h"
+
+// Mixes the outgoing and incoming images, drawn as one triangle covering the window
+static const char* fade_vertex_shader = R"(
+#version 330
+out vec2 uv;
+void main() {
+    vec2 p = vec2(gl_VertexID == 1 ? 3. : -1., gl_VertexID == 2 ? 3. : -1.);
+    uv = p * .5 + .5;
+    gl_Position = vec4(p, 0., 1.);
+}
+)";
+
+static const char* fade_fragment_shader = R"(
+#version 330
+uniform sampler2D outgoing;
+uniform sampler2D incoming;
+uniform float mix_amount;
+in vec2 uv;
+out vec4 color;
+void main() {
+    color = mix(texture(outgoing, uv), texture(incoming, uv), mix_amount);
+}
+)";
+
+static GLuint compile_fade_shader(const char* source, GLenum type) {
+    const GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    GLint compiled = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (compiled == GL_FALSE) {
+        glDeleteShader(shader);
+        throw runtime_error("Internal error: crossfade shader didn't compile.");
+    }
+    return shader;
+}
+
+vector<filesys::path> Playlist::find_presets(const filesys::path& folder) {
+    vector<filesys::path> presets;
+    std::error_code ec;
+    for (filesys::directory_iterator it(folder, ec), end; !ec && it != end; it.increment(ec))
+        if (filesys::is_directory(it->status()) && filesys::exists(it->path() / "image.frag"))
+            presets.push_back(it->path());
+    std::sort(presets.begin(), presets.end());
+    return presets;
+}
+
+Playlist::Playlist(const vector<filesys::path>& presets,
+                   const Options& options,
+                   Window& window,
+                   ShaderReloader& reloader,
+                   std::unique_ptr<ShaderConfig> config,
+                   std::unique_ptr<ShaderPrograms> programs,
+                   std::unique_ptr<Renderer> renderer)
+    : presets(presets), options(options), window(window), reloader(reloader), uniform_store(nullptr), use_counter(0),
+      shown(0), pending(-1), building(-1), outgoing(-1), state_owner(-1),
+      fade_fbos(), fade_textures(), fade_width(0), fade_height(0), fade_program(0), fade_mix_location(-1) {
+    Preset first;
+    first.config = std::move(config);
+    first.programs = std::move(programs);
+    first.renderer = std::move(renderer);
+    first.last_used = ++use_counter;
+    built.emplace(0, std::move(first));
+    shown_since = ClockT::now();
+    cout << "Showing " << presets[0].filename().string() << endl;
+
+    if (options.crossfade > 0.f) {
+        const GLuint vs = compile_fade_shader(fade_vertex_shader, GL_VERTEX_SHADER);
+        const GLuint fs = compile_fade_shader(fade_fragment_shader, GL_FRAGMENT_SHADER);
+        fade_program = glCreateProgram();
+        glAttachShader(fade_program, vs);
+        glAttachShader(fade_program, fs);
+        glLinkProgram(fade_program);
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        GLint linked = GL_FALSE;
+        glGetProgramiv(fade_program, GL_LINK_STATUS, &linked);
+        if (linked == GL_FALSE)
+            throw runtime_error("Internal error: crossfade program didn't link.");
+        glUseProgram(fade_program);
+        glUniform1i(glGetUniformLocation(fade_program, "outgoing"), 0);
+        glUniform1i(glGetUniformLocation(fade_program, "incoming"), 1);
+        fade_mix_location = glGetUniformLocation(fade_program, "mix_amount");
+    }
+}
+
+Playlist::~Playlist() {
+    // The running build may be reading the programs of a preset, which are deleted with the playlist
+    reloader.cancel();
+    glDeleteFramebuffers(2, fade_fbos);
+    glDeleteTextures(2, fade_textures);
+    glDeleteProgram(fade_program);
+}
+
+void Playlist::set_uniform_store(const UniformStore* store) {
+    uniform_store = store;
+    for (auto& b : built)
+        if (b.second.renderer)
+            b.second.renderer->set_uniform_store(store);
+}
+
+ShaderConfig& Playlist::config() {
+    return *built.at(shown).config;
+}
+
+ShaderPrograms& Playlist::programs() {
+    return *built.at(shown).programs;
+}
+
+Renderer& Playlist::renderer() {
+    return *built.at(shown).renderer;
+}
+
+int Playlist::next_preset(int from, int direction) const {
+    const int n = int(presets.size());
+    int index = from;
+    for (int i = 0; i < n; ++i) {
+        index = ((index + direction) % n + n) % n;
+        if (!failed.count(index))
+            return index;
+    }
+    return from;
+}
+
+vector<int> Playlist::upcoming() const {
+    vector<int> indices;
+    int index = shown;
+    for (int i = 0; i < options.preload; ++i) {
+        index = next_preset(index, 1);
+        if (index == shown || std::find(indices.begin(), indices.end(), index) != indices.end())
+            break;
+        indices.push_back(index);
+    }
+    return indices;
+}
+
+int Playlist::next_to_build() const {
+    auto needs_build = [this](int i) {
+        return !failed.count(i) && (!built.count(i) || stale.count(i));
+    };
+    if (pending >= 0 && needs_build(pending))
+        return pending;
+    if (stale.count(shown))
+        return shown;
+    for (int i : upcoming())
+        if (needs_build(i))
+            return i;
+    return -1;
+}
+
+size_t Playlist::preload_memory() const {
+    size_t bytes = 0;
+    for (const auto& p : built)
+        if (p.first != shown && p.first != outgoing && p.second.renderer)
+            bytes += p.second.renderer->get_gpu_memory();
+    return bytes;
+}
+
+bool Playlist::update() {
+    bool changed = false;
+    ShaderReloader::Result result;
+    if (building >= 0 && reloader.poll(result)) {
+        const int index = building;
+        building = -1;
+        changed = take_build(index, result);
+    }
+    if (building < 0) {
+        const int next = next_to_build();
+        if (next >= 0)
+            request_build(next);
+    }
+
+    // Render targets are made for the window's size, the ones not in use are made again when needed
+    if (window.size_changed)
+        for (auto& p : built)
+            if (p.first != shown && p.first != outgoing)
+                p.second.renderer.reset();
+
+    // At most one renderer a frame, and none while the preloaded ones use up the budget
+    if (preload_memory() < options.memory_budget) {
+        for (int i : upcoming()) {
+            auto p = built.find(i);
+            if (p != built.end() && !p->second.renderer) {
+                create_renderer(i);
+                enforce_budget();
+                break;
+            }
+        }
+    }
+
+    int target = -1;
+    if (window.skip_presets != 0) {
+        target = shown;
+        for (int i = 0; i < std::abs(window.skip_presets); ++i)
+            target = next_preset(target, window.skip_presets > 0 ? 1 : -1);
+        window.skip_presets = 0;
+    }
+    else if (pending < 0 && options.interval > 0.f
+             && std::chrono::duration<float>(ClockT::now() - shown_since).count() >= options.interval) {
+        target = next_preset(shown, 1);
+    }
+    if (target >= 0 && target != shown)
+        pending = target;
+    // A preset that isn't built yet is switched to once it is
+    if (pending >= 0 && built.count(pending) && !stale.count(pending)) {
+        switch_to(pending);
+        pending = -1;
+        changed = true;
+    }
+    return changed;
+}
+
+bool Playlist::take_build(int index, ShaderReloader::Result& result) {
+    stale.erase(index);
+    if (!result.error.empty()) {
+        cout << result.error << endl;
+        cout << "Failed to build preset " << presets[index].filename().string() << endl << endl;
+        failed.insert(index);
+        if (pending == index)
+            pending = -1;
+        return false;
+    }
+
+    // A preset that was built when its build was requested gave it its programs to reuse
+    auto existing = built.find(index);
+    if (existing != built.end())
+        result.programs->take_unchanged_programs(*existing->second.programs);
+    if (existing == built.end()) {
+        Preset p;
+        p.config = std::move(result.config);
+        p.programs = std::move(result.programs);
+        p.last_used = ++use_counter;
+        built.emplace(index, std::move(p));
+        return false;
+    }
+
+    // A reload of a preset in use, which keeps its renderer and the contents of its buffers if it can.
+    // The renderer reads the config through a reference, so it is assigned to rather than replaced.
+    Preset& p = existing->second;
+    if (p.renderer && result.config->same_render_targets(*p.config)) {
+        *p.config = *result.config;
+        *p.programs = std::move(*result.programs);
+        p.renderer->set_programs(p.programs.get());
+    }
+    else if (p.renderer) {
+        Renderer new_renderer(*result.config, window);
+        *p.config = *result.config;
+        *p.programs = std::move(*result.programs);
+        *p.renderer = std::move(new_renderer);
+        p.renderer->set_programs(p.programs.get());
+    }
+    else {
+        p.config = std::move(result.config);
+        p.programs = std::move(result.programs);
+    }
+    state_owner = -1;
+    cout << "Reloaded preset " << presets[index].filename().string() << endl << endl;
+    return index == shown;
+}
+
+void Playlist::request_build(int index) {
+    // A preset that is built is rebuilt from its programs, so only those whose sources changed are compiled
+    auto p = built.find(index);
+    building = index;
+    reloader.request(presets[index], presets[index] / "shader.json", p != built.end() ? p->second.programs.get() : nullptr);
+}
+
+void Playlist::create_renderer(int index) {
+    Preset& p = built.at(index);
+    p.renderer = std::make_unique<Renderer>(*p.config, window);
+    p.renderer->set_uniform_store(uniform_store);
+    p.renderer->set_programs(p.programs.get());
+    // Constructing it changed the bindings the shown renderer relies on
+    state_owner = -1;
+}
+
+void Playlist::switch_to(int index) {
+    Preset& p = built.at(index);
+    if (!p.renderer) {
+        cout << "Creating the render targets of " << presets[index].filename().string() << " while switching" << endl;
+        create_renderer(index);
+    }
+    if (outgoing >= 0 && outgoing != index)
+        end_fade();
+    if (options.crossfade > 0.f) {
+        outgoing = shown;
+        fade_start = ClockT::now();
+    }
+    shown = index;
+    shown_since = ClockT::now();
+    p.last_used = ++use_counter;
+    cout << "Showing " << presets[index].filename().string() << endl;
+    enforce_budget();
+}
+
+void Playlist::end_fade() {
+    // A preset whose files changed while it faded out is built again when it's needed
+    if (stale.count(outgoing) && outgoing != building) {
+        stale.erase(outgoing);
+        built.erase(outgoing);
+    }
+    outgoing = -1;
+}
+
+void Playlist::enforce_budget() {
+    const vector<int> next = upcoming();
+    while (preload_memory() > options.memory_budget) {
+        int oldest = -1;
+        for (const auto& p : built) {
+            const int i = p.first;
+            if (i == shown || i == outgoing || i == building || !p.second.renderer || std::find(next.begin(), next.end(), i) != next.end())
+                continue;
+            if (oldest < 0 || p.second.last_used < built.at(oldest).last_used)
+                oldest = i;
+        }
+        if (oldest < 0)
+            return;
+        built.erase(oldest);
+    }
+}
+
+void Playlist::files_changed(const std::set<string>& files) {
+    std::set<int> changed;
+    for (const string& file : files) {
+        const size_t slash = file.find('/');
+        bool in_preset = false;
+        if (slash != string::npos) {
+            for (int i = 0; i < int(presets.size()); ++i) {
+                if (presets[i].filename().string() == file.substr(0, slash)) {
+                    changed.insert(i);
+                    in_preset = true;
+                }
+            }
+        }
+        // Files outside the presets, like shared includes, may be used by any of them
+        if (!in_preset)
+            for (int i = 0; i < int(presets.size()); ++i)
+                changed.insert(i);
+    }
+
+    for (int i : changed) {
+        failed.erase(i);
+        // The running build may have read the files before they changed, it is started over. A build of
+        // the old files that finished but wasn't taken yet is thrown away, update() takes the new one.
+        if (i == building)
+            request_build(i);
+        if (!built.count(i))
+            continue;
+        // The programs of the preset being built are read by the build, so it is kept until the build is taken
+        if (i == shown || i == outgoing || i == building)
+            stale.insert(i);
+        else
+            built.erase(i);
+    }
+}
+
+void Playlist::create_fade_targets() {
+    if (fade_fbos[0] && fade_width == window.width && fade_height == window.height)
+        return;
+    if (!fade_fbos[0]) {
+        glGenTextures(2, fade_textures);
+        glGenFramebuffers(2, fade_fbos);
+    }
+    for (int i = 0; i < 2; ++i) {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, fade_textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, window.width, window.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, fade_fbos[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fade_textures[i], 0);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    fade_width = window.width;
+    fade_height = window.height;
+    state_owner = -1;
+}
+
+void Playlist::render_preset(int index, AudioData& audio_data, GLuint fbo) {
+    Renderer& r = *built.at(index).renderer;
+    if (state_owner != index) {
+        r.restore_gl_state();
+        state_owner = index;
+    }
+    r.set_output_framebuffer(fbo);
+    r.update(audio_data);
+    r.render();
+}
+
+void Playlist::render(AudioData& audio_data) {
+    const float fade_seconds = std::chrono::duration<float>(ClockT::now() - fade_start).count();
+    if (outgoing >= 0 && fade_seconds >= options.crossfade)
+        end_fade();
+    Renderer& incoming = renderer();
+    if (outgoing < 0) {
+        render_preset(shown, audio_data, incoming.get_output_framebuffer());
+        return;
+    }
+
+    create_fade_targets();
+    render_preset(outgoing, audio_data, fade_fbos[0]);
+    render_preset(shown, audio_data, fade_fbos[1]);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, incoming.get_output_framebuffer());
+    glViewport(0, 0, window.width, window.height);
+    glDisable(GL_BLEND);
+    glUseProgram(fade_program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, fade_textures[0]);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, fade_textures[1]);
+    const float t = fade_seconds / options.crossfade;
+    glUniform1f(fade_mix_location, t * t * (3.f - 2.f * t));
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    state_owner = -1;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <GL/glew.h>
+
+#include "filesystem.h"
+#include "Window.h"
+#include "ShaderConfig.h"
+#include "ShaderPrograms.h"
+#include "Renderer.h"
+#include "ShaderReloader.h"
+
+// Shows the presets in the subfolders of a folder one after another, moving on after a set time or
+// when the arrow keys are pressed, optionally crossfading from the outgoing image to the incoming one.
+//
+// The programs of the presets that come next are compiled by the reloader's thread while the shown
+// preset renders. Their renderers are created on the render thread, because framebuffers can't be
+// shared between contexts, one per frame ahead of the switch. Switching then only changes which
+// renderer draws. Presets are kept for going back until their render targets use more gpu memory
+// than the budget, then the least recently used are dropped. A preset whose files change is rebuilt
+// reusing the programs whose sources didn't, like a reload outside a playlist.
+class Playlist {
+public:
+    struct Options {
+        // Seconds each preset is shown, 0 to only switch with the arrow keys
+        float interval = 0.f;
+        // Seconds the outgoing preset fades into the incoming one, 0 to cut
+        float crossfade = 0.f;
+        // How many of the following presets are built ahead
+        int preload = 2;
+        // Bytes the renderers of the presets that aren't shown may use
+        size_t memory_budget = size_t(512) << 20;
+    };
+
+    // Subfolders of folder with an image.frag, by name
+    static std::vector<filesys::path> find_presets(const filesys::path& folder);
+
+    // Takes over the built first preset, which the renderer renders with config and programs
+    Playlist(const std::vector<filesys::path>& presets,
+             const Options& options,
+             Window& window,
+             ShaderReloader& reloader,
+             std::unique_ptr<ShaderConfig> config,
+             std::unique_ptr<ShaderPrograms> programs,
+             std::unique_ptr<Renderer> renderer);
+    ~Playlist();
+
+    // Call every frame before render(). Takes finished builds, starts the next one, creates at most one
+    // renderer and switches presets when it's time. Returns true if the shown preset changed or was reloaded.
+    bool update();
+    // Rebuilds the presets whose files changed, given relative to the playlist's folder
+    void files_changed(const std::set<std::string>& files);
+    // Updates and renders the shown preset, and the outgoing one while it fades out
+    void render(AudioData& audio_data);
+
+    // Passed to the renderers of all presets, see Renderer::set_uniform_store
+    void set_uniform_store(const UniformStore* store);
+
+    // The shown preset
+    ShaderConfig& config();
+    ShaderPrograms& programs();
+    Renderer& renderer();
+
+private:
+    Playlist(Playlist&) = delete;
+    Playlist& operator=(Playlist&) = delete;
+
+    struct Preset {
+        std::unique_ptr<ShaderConfig> config;
+        std::unique_ptr<ShaderPrograms> programs;
+        // Reads config and programs, nullptr until created or after it was dropped
+        std::unique_ptr<Renderer> renderer;
+        // Value of use_counter when the preset was last built or shown
+        int last_used;
+    };
+
+    std::vector<filesys::path> presets;
+    Options options;
+    Window& window;
+    ShaderReloader& reloader;
+    const UniformStore* uniform_store;
+
+    // Built presets by index in presets
+    std::map<int, Preset> built;
+    // Presets that failed to build, skipped until their files change
+    std::set<int> failed;
+    // Built presets whose files changed since
+    std::set<int> stale;
+    int use_counter;
+
+    int shown;
+    std::chrono::steady_clock::time_point shown_since;
+    // Preset to switch to once it is built, -1 if none
+    int pending;
+    // Preset being built by the reloader, -1 if none. Its programs, if it is built, are read by the build.
+    int building;
+    // Preset fading out, -1 if none
+    int outgoing;
+    std::chrono::steady_clock::time_point fade_start;
+    // Renderer whose gl state is set, -1 after another renderer changed it
+    int state_owner;
+
+    // Outgoing and incoming images while crossfading, and the program mixing them
+    GLuint fade_fbos[2];
+    GLuint fade_textures[2];
+    int fade_width;
+    int fade_height;
+    GLuint fade_program;
+    GLint fade_mix_location;
+
+    // The next preset in direction that didn't fail to build, starting after from
+    int next_preset(int from, int direction) const;
+    // The presets after the shown one that are built ahead
+    std::vector<int> upcoming() const;
+    // The preset to build next, -1 if none needs to be
+    int next_to_build() const;
+    // Returns true if the shown preset was reloaded
+    bool take_build(int index, ShaderReloader::Result& result);
+    // Starts building the preset, reusing the unchanged programs of its previous build if it has one
+    void request_build(int index);
+    void create_renderer(int index);
+    void switch_to(int index);
+    void end_fade();
+    // Bytes used by the renderers of the presets that aren't shown
+    size_t preload_memory() const;
+    // Drops the least recently used presets that aren't shown until the others' renderers fit the budget
+    void enforce_budget();
+    void create_fade_targets();
+    void render_preset(int index, AudioData& audio_data, GLuint fbo);
+};
@@ -0,0 +1,150 @@
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <fstream>
+#include <vector>
+using std::vector;
+#include <string>
+using std::string;
+#include <cstdio>
+#include <algorithm>
+
+#include "ProgramCache.h"
+
+// 64 bit FNV-1a, continuing from hash h
+static uint64_t fnv1a(const string& s, uint64_t h = 14695981039346656037ull) {
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    // Separate the strings so that moving text from one to the next changes the hash
+    h ^= 0xff;
+    h *= 1099511628211ull;
+    return h;
+}
+
+ProgramCache::ProgramCache(const filesys::path& folder) : folder(folder), is_enabled(false) {
+    GLint num_formats = 0;
+    if (GLEW_ARB_get_program_binary)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    if (num_formats == 0)
+        return;
+
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+        const GLubyte* s = glGetString(name);
+        driver += s ? reinterpret_cast<const char*>(s) : "";
+        driver += '\n';
+    }
+
+    std::error_code ec;
+    filesys::create_directories(folder, ec);
+    is_enabled = !ec;
+}
+
+uint64_t ProgramCache::key(const string& vertex, const string& geometry, const string& fragment) const {
+    return fnv1a(fragment, fnv1a(geometry, fnv1a(vertex, fnv1a(driver))));
+}
+
+filesys::path ProgramCache::entry_path(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return folder / name;
+}
+
+GLuint ProgramCache::load(uint64_t key) const {
+    if (!is_enabled)
+        return 0;
+    const filesys::path path = entry_path(key);
+    std::ifstream fin(path.string(), std::ios::binary | std::ios::ate);
+    if (!fin.is_open())
+        return 0;
+    const std::streamoff size = fin.tellg();
+    if (size <= std::streamoff(sizeof(GLenum)))
+        return 0;
+    fin.seekg(0);
+    GLenum format;
+    vector<char> binary(size_t(size - sizeof(GLenum)));
+    fin.read((char*)&format, sizeof(format));
+    fin.read(binary.data(), binary.size());
+    if (!fin)
+        return 0;
+
+    const GLuint program = glCreateProgram();
+    glProgramBinary(program, format, binary.data(), GLsizei(binary.size()));
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked == GL_FALSE) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    std::error_code ec;
+    filesys::last_write_time(path, filesys::file_time_type::clock::now(), ec);
+    return program;
+}
+
+void ProgramCache::store(uint64_t key, GLuint program) const {
+    if (!is_enabled)
+        return;
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    GLenum format = 0;
+    vector<char> binary(length);
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    // Write to a temporary file and rename it, so another instance never loads a partly written entry
+    const filesys::path path = entry_path(key);
+    filesys::path tmp_path = path;
+    tmp_path += ".tmp";
+    {
+        std::ofstream fout(tmp_path.string(), std::ios::binary | std::ios::trunc);
+        fout.write((const char*)&format, sizeof(format));
+        fout.write(binary.data(), length);
+        if (!fout) {
+            cout << "Failed to write " << tmp_path.string() << " to the program cache" << endl;
+            return;
+        }
+    }
+    std::error_code ec;
+    filesys::rename(tmp_path, path, ec);
+    if (!ec)
+        evict(path);
+}
+
+void ProgramCache::evict(const filesys::path& keep) const {
+    struct Entry {
+        filesys::path path;
+        filesys::file_time_type write_time;
+        uintmax_t size;
+    };
+    vector<Entry> entries;
+    uintmax_t total = 0;
+    std::error_code ec;
+    for (filesys::directory_iterator it(folder, ec), end; !ec && it != end; it.increment(ec)) {
+        const filesys::path& path = it->path();
+        if (path.extension() != ".bin")
+            continue;
+        std::error_code entry_ec;
+        Entry entry{path, filesys::last_write_time(path, entry_ec), filesys::file_size(path, entry_ec)};
+        // Another instance may have removed it meanwhile
+        if (entry_ec)
+            continue;
+        total += entry.size;
+        entries.push_back(entry);
+    }
+    if (total <= MAX_BYTES)
+        return;
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.write_time < b.write_time;
+    });
+    for (const Entry& entry : entries) {
+        if (total <= MAX_BYTES)
+            break;
+        if (entry.path == keep)
+            continue;
+        if (filesys::remove(entry.path, ec))
+            total -= entry.size;
+    }
+}
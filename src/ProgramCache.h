@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <GL/glew.h>
+
+#include "filesystem.h"
+
+// Keeps linked programs on disk with glGetProgramBinary so a shader that was compiled before, by
+// an earlier run or before a hot reload, is loaded with glProgramBinary instead of recompiled.
+//
+// A program is keyed by a hash of its shaders' sources and the driver's vendor, renderer and
+// version strings. A driver may still reject a binary, for example after an update that kept the
+// version string, then load() fails and the program is compiled and stored again.
+//
+// The folder is kept below MAX_BYTES by removing the least recently used entries when storing, a
+// load that hits an entry marks it used by updating its modification time.
+class ProgramCache {
+public:
+    // Caching is disabled if the driver can't save any program binary format
+    explicit ProgramCache(const filesys::path& folder);
+
+    bool enabled() const {
+        return is_enabled;
+    }
+
+    uint64_t key(const std::string& vertex, const std::string& geometry, const std::string& fragment) const;
+    // Returns a linked program, or 0 if the key isn't cached or the driver rejected the binary
+    GLuint load(uint64_t key) const;
+    // Saves a program that was linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+    void store(uint64_t key, GLuint program) const;
+
+    static constexpr uintmax_t MAX_BYTES = 64 * 1024 * 1024;
+
+private:
+    filesys::path folder;
+    std::string driver;
+    bool is_enabled;
+
+    filesys::path entry_path(uint64_t key) const;
+    // Removes the entries with the oldest modification times until the rest fit in MAX_BYTES, except keep
+    void evict(const filesys::path& keep) const;
+};
@@ -0,0 +1,70 @@
+#include "RenderGraph.h"
+
+RenderGraph::RenderGraph(const std::vector<int>& render_order,
+                         const std::vector<std::vector<bool>>& reads,
+                         const std::vector<bool>& covers_all_pixels,
+                         bool blend) {
+    const int num_buffers = int(reads.size()) - 1;
+    const int n = int(render_order.size());
+
+    // Position n is the image
+    auto program_at = [&](int pos) {
+        return pos < n ? render_order[pos] : num_buffers;
+    };
+
+    std::vector<int> first_write(num_buffers, -1);
+    std::vector<int> last_write(num_buffers, -1);
+    for (int k = 0; k < n; ++k) {
+        const int b = render_order[k];
+        if (first_write[b] < 0)
+            first_write[b] = k;
+        last_write[b] = k;
+    }
+
+    // Whether a read of buffer b at position j sees the write at position k
+    auto sees = [&](int j, int k, int b) {
+        if (j > k) {
+            for (int i = k + 1; i < j; ++i)
+                if (render_order[i] == b)
+                    return false;
+            return true;
+        }
+        // A pass reads its buffer before writing it, so j == first_write[b] sees last frame's write too
+        return k == last_write[b] && j <= first_write[b];
+    };
+
+    std::vector<bool> live(n + 1, false);
+    live[n] = true;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int k = 0; k < n; ++k) {
+            if (live[k])
+                continue;
+            const int b = render_order[k];
+            for (int j = 0; j <= n; ++j) {
+                if (live[j] && reads[program_at(j)][b] && sees(j, k, b)) {
+                    live[k] = true;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    live_buffers.assign(num_buffers, false);
+    single_texture.assign(num_buffers, true);
+    for (int k = 0; k < n; ++k) {
+        if (!live[k])
+            continue;
+        const int b = render_order[k];
+        passes.push_back(b);
+        live_buffers[b] = true;
+        if (reads[b][b])
+            single_texture[b] = false;
+    }
+
+    clear.resize(num_buffers + 1);
+    for (int p = 0; p <= num_buffers; ++p)
+        clear[p] = blend || !covers_all_pixels[p];
+}
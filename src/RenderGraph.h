@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+
+// Decides which passes of the render order actually need to run, by following which buffers each
+// program samples back from the image.
+//
+// A pass is live if a live pass reads what it wrote. That is a later pass in the same frame that
+// reads its buffer before the buffer is written again, or, for the last write of a buffer in the
+// frame, a pass in the next frame that reads the buffer before its first write. The image is
+// always live.
+class RenderGraph {
+public:
+    // render_order: indices of the buffers in the order they are drawn
+    // reads[p][b]: program p samples buffer b. Program num_buffers is the image.
+    // covers_all_pixels[p]: program p writes every pixel of its target, so the target needs no clear
+    //     unless blending mixes the new colors with the old ones
+    RenderGraph(const std::vector<int>& render_order,
+                const std::vector<std::vector<bool>>& reads,
+                const std::vector<bool>& covers_all_pixels,
+                bool blend);
+    RenderGraph() = default;
+
+    // The live passes of render_order, in order
+    std::vector<int> passes;
+    // clear[p]: the target of program p must be cleared before drawing
+    std::vector<bool> clear;
+    // single_texture[b]: buffer b never samples itself, so both of its ping pong textures can be the same texture
+    std::vector<bool> single_texture;
+    // live_buffers[b]: some pass of buffer b is live
+    std::vector<bool> live_buffers;
+};
@@ -1,7 +1,10 @@
 #include <iostream>
 using std::cout;
 using std::endl;
+#include <algorithm>
 #include <chrono>
+#include <stdexcept>
+using std::runtime_error;
 namespace chrono = std::chrono;
 using ClockT = std::chrono::steady_clock;
 
@@ -21,6 +24,68 @@ void GLAPIENTRY MessageCallback(GLenum source,
 // TODO Test the output of the shaders. Use dummy data in AudioData. Compute similarity between
 // expected images and produced images.
 
+// Allocates storage for the texture bound to GL_TEXTURE_2D in the buffer's format and render size
+static void allocate_buffer_texture(const Buffer& buff) {
+    GLint internal_format = GL_RGBA32F; // how is the data stored on the gfx card
+    GLenum format = GL_RGBA;            // describes how the data is stored on the cpu, there is none here
+    GLenum type = GL_FLOAT;
+    switch (buff.format) {
+    case BufferFormat::RGBA32F:
+        break;
+    case BufferFormat::RGBA16F:
+        internal_format = GL_RGBA16F;
+        break;
+    case BufferFormat::RGBA8:
+        internal_format = GL_RGBA8;
+        type = GL_UNSIGNED_BYTE;
+        break;
+    case BufferFormat::RG16F:
+        internal_format = GL_RG16F;
+        format = GL_RG;
+        break;
+    case BufferFormat::R32F:
+        internal_format = GL_R32F;
+        format = GL_RED;
+        break;
+    }
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, buff.width, buff.height, 0, format, type, nullptr);
+}
+
+static void set_blending(bool blend) {
+    if (blend) {
+        // I chose the following blending func because it allows the user to completely
+        // replace the colors in the buffer by setting their output alpha to 1.
+        // unfortunately it forces the user to make one of three choices:
+        // 1) replace color in the framebuffer
+        // 2) leave framebuffer unchanged
+        // 3) mix new color with old color
+        glEnable(GL_BLEND);
+        // mix(old_color.rgb, new_color.rgb, new_color_alpha)
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+    else {
+        glDisable(GL_BLEND);
+    }
+}
+
+// Bytes of one of the buffer's textures
+static size_t buffer_texture_bytes(const Buffer& buff) {
+    size_t texel_bytes = 16;
+    switch (buff.format) {
+    case BufferFormat::RGBA32F:
+        break;
+    case BufferFormat::RGBA16F:
+        texel_bytes = 8;
+        break;
+    case BufferFormat::RGBA8:
+    case BufferFormat::RG16F:
+    case BufferFormat::R32F:
+        texel_bytes = 4;
+        break;
+    }
+    return texel_bytes * buff.width * buff.height;
+}
+
 // TODO add a previously rendered uniform so that a single buffer can be repetitvely applied
 
 // TODO buffer.size option is ShaderConfig is not rendered correctly, rendering to half res and then upscaling in image.frag doesn't work as expected
@@ -32,48 +97,104 @@ Renderer& Renderer::operator=(Renderer&& o) {
     glDeleteTextures(fbo_textures.size(), fbo_textures.data());
     // Textures in fbo_textures are unboud from their targets
 
-    glDeleteTextures(audio_textures.size(), audio_textures.data());
+    glDeleteTextures(1, &audio_texture);
+    glDeleteTextures(1, &spectrogram_texture);
+    delete_audio_pbos();
+    glDeleteBuffers(1, &frame_ubo);
+    glDeleteBuffers(1, &pass_ubo);
+    glDeleteQueries(GPU_QUERY_COUNT, gpu_time_queries);
+    glDeleteFramebuffers(1, &image_fbo);
+    glDeleteTextures(1, &image_texture);
+    glDeleteFramebuffers(1, &output_fbo);
+    glDeleteTextures(1, &output_texture);
+    glDeleteFramebuffers(1, &tile_fbo);
+    glDeleteTextures(1, &tile_texture);
 
     fbos = std::move(o.fbos);
     fbo_textures = std::move(o.fbo_textures);
-    audio_textures = std::move(o.audio_textures);
+    texture_sizes = std::move(o.texture_sizes);
+    audio_texture = o.audio_texture;
     buffers_last_drawn = std::move(o.buffers_last_drawn);
     num_user_buffers = o.num_user_buffers;
     frame_counter = o.frame_counter;
     elapsed_time = o.elapsed_time;
+    fixed_time = o.fixed_time;
+    audio_pbos = std::move(o.audio_pbos);
+    audio_pbo_ptrs = std::move(o.audio_pbo_ptrs);
+    audio_pbo_fences = std::move(o.audio_pbo_fences);
+    audio_pbo_index = o.audio_pbo_index;
+    audio_pbos_persistent = o.audio_pbos_persistent;
+    spectrogram_texture = o.spectrogram_texture;
+    spectrogram_unit = o.spectrogram_unit;
+    spectrogram_frames_uploaded = o.spectrogram_frames_uploaded;
+    spectrogram_offset = o.spectrogram_offset;
+    spectrogram_staging = std::move(o.spectrogram_staging);
+    audio_generation = o.audio_generation;
+    gl_state = o.gl_state;
+    render_graph = std::move(o.render_graph);
+    dynamic_resolution = o.dynamic_resolution;
+    std::copy(o.gpu_time_queries, o.gpu_time_queries + GPU_QUERY_COUNT, gpu_time_queries);
+    gpu_query_frame = o.gpu_query_frame;
+    scratch_unit = o.scratch_unit;
+    image_fbo = o.image_fbo;
+    image_texture = o.image_texture;
+    output_fbo = o.output_fbo;
+    output_texture = o.output_texture;
+    target_fbo = o.target_fbo;
+    max_render_size = o.max_render_size;
+    tile_fbo = o.tile_fbo;
+    tile_texture = o.tile_texture;
+    tile_texture_size = o.tile_texture_size;
+    tile_pixels = std::move(o.tile_pixels);
+    std::copy(o.tile_offset, o.tile_offset + 2, tile_offset);
+    std::copy(o.tile_extent, o.tile_extent + 2, tile_extent);
+    frame_ubo = o.frame_ubo;
+    pass_ubo = o.pass_ubo;
+    ubo_offset_alignment = o.ubo_offset_alignment;
+    pass_ubo_stride = o.pass_ubo_stride;
+    frame_uniform_data = std::move(o.frame_uniform_data);
+    pass_uniform_data = std::move(o.pass_uniform_data);
+    audio_capture_time = o.audio_capture_time;
+    std::copy(o.audio_loudness, o.audio_loudness + 4, audio_loudness);
+    std::copy(o.audio_peak, o.audio_peak + 2, audio_peak);
+    std::copy(o.audio_spectral, o.audio_spectral + 4, audio_spectral);
+    std::copy(o.audio_chroma, o.audio_chroma + 12, audio_chroma);
+    user_uniforms = std::move(o.user_uniforms);
 
     o.fbos.clear();
     o.fbo_textures.clear();
-    o.audio_textures.clear();
+    o.texture_sizes.clear();
+    o.audio_texture = 0;
+    o.frame_ubo = 0;
+    o.pass_ubo = 0;
+    std::fill(o.gpu_time_queries, o.gpu_time_queries + GPU_QUERY_COUNT, 0);
+    o.image_fbo = 0;
+    o.image_texture = 0;
+    o.output_fbo = 0;
+    o.output_texture = 0;
+    o.target_fbo = 0;
+    o.tile_fbo = 0;
+    o.tile_texture = 0;
+    o.audio_pbos.clear();
+    o.audio_pbo_ptrs.clear();
+    o.audio_pbo_fences.clear();
     o.buffers_last_drawn.clear();
     o.num_user_buffers = 0;
     o.frame_counter = 0;
     o.elapsed_time = 0;
+    o.spectrogram_texture = 0;
 
     return *this;
 }
 
 Renderer::Renderer(const ShaderConfig& config, const Window& window)
-    : config(config), window(window), frame_counter(0), num_user_buffers(0), buffers_last_drawn(config.mBuffers.size(), 0) {
+    : config(config), window(window), audio_loudness(), audio_peak(), audio_spectral(), audio_chroma(), uniform_store(nullptr), uniform_store_generation(0), frame_counter(0), num_user_buffers(0), buffers_last_drawn(config.mBuffers.size(), 0) {
 #ifdef _DEBUG
     glEnable(GL_DEBUG_OUTPUT);
     glDebugMessageCallback(MessageCallback, 0);
 #endif
 
-    if (config.mBlend) {
-        // I chose the following blending func because it allows the user to completely
-        // replace the colors in the buffer by setting their output alpha to 1.
-        // unfortunately it forces the user to make one of three choices:
-        // 1) replace color in the framebuffer
-        // 2) leave framebuffer unchanged
-        // 3) mix new color with old color
-        glEnable(GL_BLEND);
-        // mix(old_color.rgb, new_color.rgb, new_color_alpha)
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    }
-    else {
-        glDisable(GL_BLEND);
-    }
+    set_blending(config.mBlend);
 
     //glGetIntegerv(GL_MAX_GEOMETRY_OUTPUT_VERTICES, &max_output_vertices);
     //glEnable(GL_DEPTH_TEST); // maybe allow as option so that geom shaders are more useful
@@ -85,65 +206,156 @@ Renderer::Renderer(const ShaderConfig& config, const Window& window)
     glBindVertexArray(vao);
 
     num_user_buffers = int(config.mBuffers.size());
+    // Units: the audio texture, one per buffer, the spectrogram and the scratch unit
+    GLint max_combined_units;
+    glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &max_combined_units);
+    const int max_units = std::min(int(max_combined_units), GLState::MAX_TEXTURE_UNITS);
+    const int units = get_spectrogram_unit(num_user_buffers) + 2;
+    if (units > max_units)
+        throw runtime_error("Too many buffers, rendering them needs " + std::to_string(units) + " texture units but only "
+                            + std::to_string(max_units) + " are available");
 
     // Create framebuffers and textures
+    fbo_textures.resize(2 * num_user_buffers);
+    fbos.resize(2 * num_user_buffers);
+    texture_sizes.resize(num_user_buffers + 1);
     for (int i = 0; i < num_user_buffers; ++i) {
-        GLuint tex1, tex2, fbo;
+        const Buffer buff = get_pass_buffer(i);
+        texture_sizes[i] = {buff.width, buff.height};
+        create_buffer_target(i, fbo_textures[2 * i], fbos[2 * i]);
+        create_buffer_target(i, fbo_textures[2 * i + 1], fbos[2 * i + 1]);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-        Buffer buff = config.mBuffers[i];
-        if (buff.is_window_size) {
-            buff.width = window.width;
-            buff.height = window.height;
+    // Generate the audio texture. One layer per channel: iSoundR, iSoundL, iFreqR, iFreqL
+    glGenTextures(1, &audio_texture);
+    glActiveTexture(GL_TEXTURE0 + AUDIO_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_1D_ARRAY, audio_texture);
+    glTexImage2D(GL_TEXTURE_1D_ARRAY, 0, GL_R32F, VISUALIZER_BUFSIZE, AUDIO_TEXTURE_LAYERS, 0, GL_RED, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_1D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_1D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // Pixel buffers that the audio texture is uploaded from, layer 0 data then layer 1 data then ...
+    // Persistently mapped when GL_ARB_buffer_storage is available, otherwise orphaned every upload.
+    audio_pbos.resize(AUDIO_PBO_COUNT);
+    audio_pbo_ptrs.assign(AUDIO_PBO_COUNT, nullptr);
+    audio_pbo_fences.assign(AUDIO_PBO_COUNT, nullptr);
+    audio_pbo_index = 0;
+    audio_generation = -1;
+    audio_pbos_persistent = GLEW_ARB_buffer_storage;
+    glGenBuffers(AUDIO_PBO_COUNT, audio_pbos.data());
+    for (int i = 0; i < AUDIO_PBO_COUNT; ++i) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, audio_pbos[i]);
+        if (audio_pbos_persistent) {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, AUDIO_PBO_SIZE, nullptr, flags);
+            audio_pbo_ptrs[i] = (float*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, AUDIO_PBO_SIZE, flags);
         }
-
-        glActiveTexture(GL_TEXTURE0 + i);
-        glGenTextures(1, &tex1);
-        glBindTexture(GL_TEXTURE_2D, tex1);
-        glTexImage2D(GL_TEXTURE_2D, // which binding point on the current active texture
-                     0,
-                     GL_RGBA32F, // how is the data stored on the gfx card
-                     buff.width, buff.height, 0,
-                     GL_RGBA, GL_FLOAT, nullptr); // describes how the data is stored on the cpu
-        // TODO parameterize wrap behavior
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        glGenTextures(1, &tex2);
-        glGenTextures(1, &tex2);
-        glBindTexture(GL_TEXTURE_2D, tex2);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, buff.width, buff.height, 0, GL_RGBA, GL_FLOAT, nullptr);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        else {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, AUDIO_PBO_SIZE, nullptr, GL_STREAM_DRAW);
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // Generate the spectrogram texture. Only the newest columns are uploaded each frame, and
+    // wrapping in s lets shaders read the history starting from spectrogram_offset.
+    spectrogram_unit = get_spectrogram_unit(num_user_buffers);
+    spectrogram_frames_uploaded = 0;
+    spectrogram_offset = 0.f;
+    std::vector<float> zeros(SPECTROGRAM_LEN * VISUALIZER_BUFSIZE * 2, 0.f);
+    glGenTextures(1, &spectrogram_texture);
+    glActiveTexture(GL_TEXTURE0 + spectrogram_unit);
+    glBindTexture(GL_TEXTURE_2D, spectrogram_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, SPECTROGRAM_LEN, VISUALIZER_BUFSIZE, 0, GL_RG, GL_FLOAT, zeros.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // Timer queries for the gpu time of render(), and when the resolution can be lowered, a framebuffer
+    // for rendering the image below the window's resolution
+    dynamic_resolution = DynamicResolution(config.mDynamic_resolution.enabled,
+                                           config.mDynamic_resolution.target_ms,
+                                           config.mDynamic_resolution.min_scale);
+    glGenQueries(GPU_QUERY_COUNT, gpu_time_queries);
+    gpu_query_frame = 0;
+    scratch_unit = spectrogram_unit + 1;
+
+    // Images larger than this can only be rendered in tiles
+    GLint max_viewport_dims[2];
+    GLint max_texture_size;
+    glGetIntegerv(GL_MAX_VIEWPORT_DIMS, max_viewport_dims);
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    max_render_size = std::min({max_viewport_dims[0], max_viewport_dims[1], max_texture_size});
+    tile_fbo = 0;
+    tile_texture = 0;
+    tile_texture_size = 0;
+    tile_offset[0] = 0.f;
+    tile_offset[1] = 0.f;
+    tile_extent[0] = 0.f;
+    tile_extent[1] = 0.f;
+
+    image_fbo = 0;
+    image_texture = 0;
+    if (config.mDynamic_resolution.enabled && !needs_tiling()) {
+        const Buffer image = get_pass_buffer(num_user_buffers);
+        texture_sizes[num_user_buffers] = {image.width, image.height};
+        glGenTextures(1, &image_texture);
+        glActiveTexture(GL_TEXTURE0 + scratch_unit);
+        glBindTexture(GL_TEXTURE_2D, image_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        glGenFramebuffers(1, &fbo);
-        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex1, 0);
-
-        fbo_textures.push_back(tex1);
-        fbo_textures.push_back(tex2);
-        fbos.push_back(fbo);
+        glGenFramebuffers(1, &image_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, image_fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, image_texture, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    // Generate audio textures
-    for (int i = 0; i < 4; ++i) {
-        GLuint tex;
-        glGenTextures(1, &tex);
-        glActiveTexture(GL_TEXTURE0 + i);
-        glBindTexture(GL_TEXTURE_1D, tex);
-        glTexImage1D(GL_TEXTURE_1D, 0, GL_R32F, VISUALIZER_BUFSIZE, 0, GL_RED, GL_FLOAT, nullptr);
-        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        audio_textures.push_back(tex);
+    // A headless window has no default framebuffer, so the finished image goes to a window sized texture
+    output_fbo = 0;
+    output_texture = 0;
+    if (window.headless && !needs_tiling()) {
+        glGenTextures(1, &output_texture);
+        glActiveTexture(GL_TEXTURE0 + scratch_unit);
+        glBindTexture(GL_TEXTURE_2D, output_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, window.width, window.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glGenFramebuffers(1, &output_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, output_fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, output_texture, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
+    target_fbo = output_fbo;
+
+    // Uniform buffers, sized once the programs are known in set_programs
+    glGenBuffers(1, &frame_ubo);
+    glGenBuffers(1, &pass_ubo);
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &ubo_offset_alignment);
+    pass_ubo_stride = 0;
 
     start_time = ClockT::now();
+    fixed_time = -1.f;
+}
+
+void Renderer::create_buffer_target(int b, GLuint& tex, GLuint& fbo) {
+    glActiveTexture(GL_TEXTURE0 + FIRST_BUFFER_TEXTURE_UNIT + b);
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    allocate_buffer_texture(get_pass_buffer(b));
+    // Linear filtering also smooths buffers rendered below the window's resolution when they are sampled
+    // TODO parameterize wrap behavior
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // One framebuffer per texture so the attachments never change while rendering
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
 }
 
 Renderer::~Renderer() {
@@ -155,15 +367,38 @@ Renderer::~Renderer() {
     glDeleteTextures(fbo_textures.size(), fbo_textures.data());
     // Textures in fbo_textures are unboud from their targets
 
-    glDeleteTextures(audio_textures.size(), audio_textures.data());
+    glDeleteTextures(1, &audio_texture);
+    glDeleteTextures(1, &spectrogram_texture);
+    delete_audio_pbos();
+    glDeleteBuffers(1, &frame_ubo);
+    glDeleteBuffers(1, &pass_ubo);
+    glDeleteQueries(GPU_QUERY_COUNT, gpu_time_queries);
+    glDeleteFramebuffers(1, &image_fbo);
+    glDeleteTextures(1, &image_texture);
+    glDeleteFramebuffers(1, &output_fbo);
+    glDeleteTextures(1, &output_texture);
+    glDeleteFramebuffers(1, &tile_fbo);
+    glDeleteTextures(1, &tile_texture);
+}
+
+void Renderer::delete_audio_pbos() {
+    for (GLsync fence : audio_pbo_fences)
+        if (fence)
+            glDeleteSync(fence);
+    // Deleting a mapped buffer unmaps it
+    glDeleteBuffers(audio_pbos.size(), audio_pbos.data());
+    audio_pbos.clear();
+    audio_pbo_ptrs.clear();
+    audio_pbo_fences.clear();
 }
 
 void Renderer::update(AudioData& data) {
-    // Update audio textures
+    // Update audio texture
     // glActivateTexture activates a certain texture unit.
     // each texture unit holds one texture of each dimension of texture
     //     {GL_TEXTURE_1D, GL_TEXTURE_2D, GL_TEXTURE_3D, GL_TEXTURE_CUBEMAP}
-    // because I'm using four 1D textures I need to store them in separate texture units
+    // All four audio channels are layers of one 1D array texture, so they take one texture unit
+    // and one upload.
     //
     // glUniform1i(textureLoc, int) sets what texture unit the sampler in the shader reads from
     //
@@ -171,34 +406,100 @@ void Renderer::update(AudioData& data) {
     // bound to the same target (in the active unit? I think), or until the bound texture is deleted
     // with glDeleteTextures. So I do not need to rebind
     // glBindTexture(GL_TEXTURE_1D, tex[X]);
+    //
+    // The audio data goes through a ring of pixel buffer objects so that glTexSubImage1D reads from
+    // gpu visible memory and returns without copying. While the audio mutex is held we only memcpy
+    // into the buffer, the uploads are issued after it is released. New spectrogram columns are copied
+    // to spectrogram_staging and uploaded after it is released too.
+    // AudioProcess's buffers hold the state its smoothing mixes with, so it can not write into the
+    // pixel buffers itself.
+    //
+    // The audio only changes when AudioProcess publishes a new analysis frame, 60 times a second.
+    // Skip the upload when the display runs faster than that or the audio is paused.
     data.mtx.lock();
-    glActiveTexture(GL_TEXTURE0 + 0);
-    glTexSubImage1D(GL_TEXTURE_1D, 0, 0, VISUALIZER_BUFSIZE, GL_RED, GL_FLOAT, data.audio_r);
-    glActiveTexture(GL_TEXTURE0 + 1);
-    glTexSubImage1D(GL_TEXTURE_1D, 0, 0, VISUALIZER_BUFSIZE, GL_RED, GL_FLOAT, data.audio_l);
-    glActiveTexture(GL_TEXTURE0 + 2);
-    glTexSubImage1D(GL_TEXTURE_1D, 0, 0, VISUALIZER_BUFSIZE, GL_RED, GL_FLOAT, data.freq_r);
-    glActiveTexture(GL_TEXTURE0 + 3);
-    glTexSubImage1D(GL_TEXTURE_1D, 0, 0, VISUALIZER_BUFSIZE, GL_RED, GL_FLOAT, data.freq_l);
+    const bool new_audio_frame = data.generation != audio_generation;
+    data.mtx.unlock();
+    if (!new_audio_frame) {
+        update();
+        return;
+    }
+
+    const int slot = audio_pbo_index;
+    audio_pbo_index = (audio_pbo_index + 1) % AUDIO_PBO_COUNT;
+    float* dst;
+    if (audio_pbos_persistent) {
+        // The upload from this slot was issued AUDIO_PBO_COUNT frames ago, so this rarely waits
+        if (audio_pbo_fences[slot]) {
+            gl_state.call(glClientWaitSync, audio_pbo_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1e9));
+            gl_state.call(glDeleteSync, audio_pbo_fences[slot]);
+            audio_pbo_fences[slot] = nullptr;
+        }
+        dst = audio_pbo_ptrs[slot];
+    }
+    else {
+        // Orphan the buffer so the driver gives us fresh memory instead of waiting on the gpu
+        gl_state.bind_buffer(GL_PIXEL_UNPACK_BUFFER, audio_pbos[slot]);
+        gl_state.call(glBufferData, GL_PIXEL_UNPACK_BUFFER, AUDIO_PBO_SIZE, nullptr, GL_STREAM_DRAW);
+        dst = (float*)gl_state.call(glMapBufferRange, GL_PIXEL_UNPACK_BUFFER, 0, AUDIO_PBO_SIZE, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        // Client memory uploads below must not read from the pixel buffer
+        gl_state.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    data.mtx.lock();
+    if (dst) {
+        std::copy(data.audio_r, data.audio_r + VISUALIZER_BUFSIZE, dst + 0 * VISUALIZER_BUFSIZE);
+        std::copy(data.audio_l, data.audio_l + VISUALIZER_BUFSIZE, dst + 1 * VISUALIZER_BUFSIZE);
+        std::copy(data.freq_r, data.freq_r + VISUALIZER_BUFSIZE, dst + 2 * VISUALIZER_BUFSIZE);
+        std::copy(data.freq_l, data.freq_l + VISUALIZER_BUFSIZE, dst + 3 * VISUALIZER_BUFSIZE);
+    }
+    audio_capture_time = data.capture_time;
+    audio_generation = data.generation;
+
+    // Copy the spectra produced since the last upload, usually one column, to upload them once the lock is released
+    const int new_columns = std::min(data.spectrogram_frames - spectrogram_frames_uploaded, SPECTROGRAM_LEN);
+    const int first_new_frame = data.spectrogram_frames - new_columns;
+    if (new_columns > 0) {
+        const int column_size = VISUALIZER_BUFSIZE * 2;
+        if (int(spectrogram_staging.size()) < new_columns * column_size)
+            spectrogram_staging.resize(new_columns * column_size);
+        for (int c = 0; c < new_columns; ++c) {
+            const float* column = data.spectrogram + (first_new_frame + c) % SPECTROGRAM_LEN * column_size;
+            std::copy(column, column + column_size, spectrogram_staging.data() + c * column_size);
+        }
+        spectrogram_frames_uploaded = data.spectrogram_frames;
+        spectrogram_offset = float(data.spectrogram_frames % SPECTROGRAM_LEN) / SPECTROGRAM_LEN;
+    }
+    std::copy(data.loudness, data.loudness + 4, audio_loudness);
+    std::copy(data.peak, data.peak + 2, audio_peak);
+    std::copy(data.spectral, data.spectral + 4, audio_spectral);
+    std::copy(data.chroma, data.chroma + 12, audio_chroma);
     data.mtx.unlock();
 
+    if (new_columns > 0) {
+        gl_state.bind_texture(spectrogram_unit, GL_TEXTURE_2D, spectrogram_texture);
+        for (int c = 0; c < new_columns; ++c)
+            gl_state.call(glTexSubImage2D, GL_TEXTURE_2D, 0, (first_new_frame + c) % SPECTROGRAM_LEN, 0, 1, VISUALIZER_BUFSIZE, GL_RG, GL_FLOAT,
+                          (const void*)(spectrogram_staging.data() + c * VISUALIZER_BUFSIZE * 2));
+    }
+
+    gl_state.bind_buffer(GL_PIXEL_UNPACK_BUFFER, audio_pbos[slot]);
+    if (!audio_pbos_persistent)
+        gl_state.call(glUnmapBuffer, GL_PIXEL_UNPACK_BUFFER);
+    if (dst) {
+        // With a pixel buffer bound the data pointer is an offset into the buffer
+        gl_state.bind_texture(AUDIO_TEXTURE_UNIT, GL_TEXTURE_1D_ARRAY, audio_texture);
+        gl_state.call(glTexSubImage2D, GL_TEXTURE_1D_ARRAY, 0, 0, 0, VISUALIZER_BUFSIZE, AUDIO_TEXTURE_LAYERS, GL_RED, GL_FLOAT, nullptr);
+    }
+    if (audio_pbos_persistent)
+        audio_pbo_fences[slot] = gl_state.call(glFenceSync, GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gl_state.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
     update();
 }
 
 void Renderer::update() {
     if (window.size_changed) {
-        // Resize textures for window sized buffers
-        for (int i = 0; i < config.mBuffers.size(); ++i) {
-            Buffer buff = config.mBuffers[i];
-            if (buff.is_window_size) {
-                buff.width = window.width;
-                buff.height = window.height;
-            }
-            glBindTexture(GL_TEXTURE_2D, fbo_textures[2 * i]);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, buff.width, buff.height, 0, GL_RGBA, GL_FLOAT, nullptr);
-            glBindTexture(GL_TEXTURE_2D, fbo_textures[2 * i + 1]);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, buff.width, buff.height, 0, GL_RGBA, GL_FLOAT, nullptr);
-        }
+        resize_buffers();
         frame_counter = 0;
         start_time = ClockT::now();
         // for (int& bld : buffers_last_drawn) {
@@ -207,81 +508,323 @@ void Renderer::update() {
     }
 }
 
+void Renderer::resize_buffers() {
+    // Resize textures for window sized buffers. Fixed size buffers keep their contents.
+    for (int i = 0; i < num_user_buffers; ++i) {
+        const Buffer buff = get_pass_buffer(i);
+        if (texture_sizes[i] == std::make_pair(buff.width, buff.height))
+            continue;
+        texture_sizes[i] = {buff.width, buff.height};
+        const int unit = FIRST_BUFFER_TEXTURE_UNIT + i;
+        gl_state.bind_texture(unit, GL_TEXTURE_2D, fbo_textures[2 * i]);
+        allocate_buffer_texture(buff);
+        if (fbo_textures[2 * i + 1] != fbo_textures[2 * i]) {
+            gl_state.bind_texture(unit, GL_TEXTURE_2D, fbo_textures[2 * i + 1]);
+            allocate_buffer_texture(buff);
+        }
+        // Leave the most recently drawn texture bound to the buffer's unit
+        gl_state.bind_texture(unit, GL_TEXTURE_2D, fbo_textures[2 * i + buffers_last_drawn[i]]);
+    }
+
+    const Buffer image = get_pass_buffer(num_user_buffers);
+    if (image_texture && texture_sizes[num_user_buffers] != std::make_pair(image.width, image.height)) {
+        texture_sizes[num_user_buffers] = {image.width, image.height};
+        gl_state.bind_texture(scratch_unit, GL_TEXTURE_2D, image_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    if (output_texture) {
+        gl_state.bind_texture(scratch_unit, GL_TEXTURE_2D, output_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, window.width, window.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+}
+
 void Renderer::render() {
     auto now = ClockT::now();
-    elapsed_time = (now - start_time).count() / 1e9f;
-
-    // Render buffers
-    for (const int r : config.mRender_order) {
-        Buffer buff = config.mBuffers[r];
-        if (buff.is_window_size) {
-            buff.width = window.width;
-            buff.height = window.height;
+    elapsed_time = fixed_time >= 0.f ? fixed_time : (now - start_time).count() / 1e9f;
+
+    // Time the gpu work of every frame. The result of the query issued GPU_QUERY_COUNT - 1 frames
+    // ago is usually ready, if it isn't the measurement is dropped rather than waiting for it.
+    const GLuint query = gpu_time_queries[gpu_query_frame % GPU_QUERY_COUNT];
+    if (gpu_query_frame >= GPU_QUERY_COUNT) {
+        GLint available = 0;
+        gl_state.call(glGetQueryObjectiv, query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 gpu_ns = 0;
+            gl_state.call(glGetQueryObjectui64v, query, GL_QUERY_RESULT, &gpu_ns);
+            if (fixed_time < 0.f && dynamic_resolution.add_frame(gpu_ns / 1e6f))
+                resize_buffers();
+        }
+    }
+    gl_state.call(glBeginQuery, GL_TIME_ELAPSED, query);
+
+    upload_uniforms();
+
+    render_buffers();
+
+    // Render image
+    gl_state.use_program(shaders->get_program(num_user_buffers));
+    const Buffer buff = get_pass_buffer(num_user_buffers);
+    gl_state.bind_buffer_range(ShaderPrograms::PASS_UNIFORMS_BINDING, pass_ubo, num_user_buffers * pass_ubo_stride, shaders->pass_block_size);
+    // Below full resolution the image is drawn offscreen and scaled up to the window by a blit
+    const bool upscale = image_fbo && (buff.width != window.width || buff.height != window.height);
+    gl_state.bind_framebuffer(upscale ? image_fbo : target_fbo);
+    gl_state.viewport(buff.width, buff.height);
+    if (render_graph.clear[num_user_buffers]) {
+        gl_state.clear_color(buff.clear_color[0], buff.clear_color[1], buff.clear_color[2], 1.f);
+        gl_state.call(glClear, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+    gl_state.call(glDrawArrays, GL_POINTS, 0, buff.geom_iters);
+    if (upscale) {
+        gl_state.call(glBindFramebuffer, GL_DRAW_FRAMEBUFFER, target_fbo);
+        gl_state.call(glBlitFramebuffer, 0, 0, buff.width, buff.height, 0, 0, window.width, window.height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        gl_state.bind_framebuffer(target_fbo);
+    }
+    gl_state.call(glEndQuery, GL_TIME_ELAPSED);
+    gpu_query_frame++;
+    frame_counter++;
+    gl_state.begin_frame();
+}
+
+void Renderer::render_buffers() {
+    // Buffer r reads its last drawn texture through its texture unit and draws into the other one
+    // through that texture's framebuffer. Afterwards the newly drawn texture is bound to the unit, so
+    // at the start of the next pass over r the binding is already in place and is skipped.
+    for (const int r : render_graph.passes) {
+        const Buffer buff = get_pass_buffer(r);
+        // Buffers that update less often keep showing their last drawn texture in between
+        if (frame_counter % buff.update_every_n_frames != 0)
+            continue;
+        gl_state.use_program(shaders->get_program(r));
+        gl_state.bind_buffer_range(ShaderPrograms::PASS_UNIFORMS_BINDING, pass_ubo, r * pass_ubo_stride, shaders->pass_block_size);
+        gl_state.bind_texture(FIRST_BUFFER_TEXTURE_UNIT + r, GL_TEXTURE_2D, fbo_textures[2 * r + buffers_last_drawn[r]]);
+        gl_state.bind_framebuffer(fbos[2 * r + (buffers_last_drawn[r] + 1) % 2]);
+        gl_state.viewport(buff.width, buff.height);
+        if (render_graph.clear[r]) {
+            gl_state.clear_color(buff.clear_color[0], buff.clear_color[1], buff.clear_color[2], 1.f);
+            gl_state.call(glClear, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         }
-        shaders->use_program(r);
-        upload_uniforms(buff, r);
-        glActiveTexture(GL_TEXTURE0 + r);
-        glBindTexture(GL_TEXTURE_2D, fbo_textures[2 * r + buffers_last_drawn[r]]);
-        glBindFramebuffer(GL_FRAMEBUFFER, fbos[r]);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fbo_textures[2 * r + (buffers_last_drawn[r] + 1) % 2], 0);
-        glViewport(0, 0, buff.width, buff.height);
-        glClearColor(buff.clear_color[0], buff.clear_color[1], buff.clear_color[2], 1.f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glDrawArrays(GL_POINTS, 0, buff.geom_iters);
+        gl_state.call(glDrawArrays, GL_POINTS, 0, buff.geom_iters);
         buffers_last_drawn[r] += 1;
         buffers_last_drawn[r] %= 2;
         // bind most recently drawn texture to texture unit r so other buffers can use it
-        glBindTexture(GL_TEXTURE_2D, fbo_textures[2 * r + buffers_last_drawn[r]]);
+        gl_state.bind_texture(FIRST_BUFFER_TEXTURE_UNIT + r, GL_TEXTURE_2D, fbo_textures[2 * r + buffers_last_drawn[r]]);
     }
+}
 
-    // Render image
-    shaders->use_program(num_user_buffers);
-    Buffer buff = config.mImage;
-    if (buff.is_window_size) {
-        buff.width = window.width;
-        buff.height = window.height;
+void Renderer::render_tiled(int tile_size, const std::function<void(int x, int y, int width, int height, const unsigned char* rgba)>& tile_done) {
+    // Fixed size buffers are rendered whole as usual. Window sized ones would have to be rendered at the size
+    // that doesn't fit, and can't be split into tiles because a pass reading them, including their own
+    // feedback pass, may sample any of their pixels.
+    for (const int r : render_graph.passes)
+        if (config.mBuffers[r].is_window_size)
+            throw runtime_error("Buffer " + config.mBuffers[r].name + " is window sized, only the image and fixed size buffers can be rendered in tiles");
+    // The default geometry shader draws each tile's part of the image, a custom one positions in the whole viewport
+    if (!config.mImage.uses_default_geometry_shader)
+        throw runtime_error("The image has its own geometry shader, only images drawn by the default one can be rendered in tiles");
+    tile_size = std::min(tile_size, max_render_size);
+
+    if (tile_size != tile_texture_size) {
+        if (!tile_texture) {
+            glGenTextures(1, &tile_texture);
+            glGenFramebuffers(1, &tile_fbo);
+        }
+        gl_state.bind_texture(scratch_unit, GL_TEXTURE_2D, tile_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tile_size, tile_size, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        gl_state.bind_framebuffer(tile_fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tile_texture, 0);
+        tile_texture_size = tile_size;
+        tile_pixels.resize(4 * tile_size * tile_size);
     }
-    upload_uniforms(buff, num_user_buffers);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glViewport(0, 0, buff.width, buff.height);
-    glClearColor(buff.clear_color[0], buff.clear_color[1], buff.clear_color[2], 1.f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glDrawArrays(GL_POINTS, 0, buff.geom_iters);
+
+    elapsed_time = fixed_time >= 0.f ? fixed_time : (ClockT::now() - start_time).count() / 1e9f;
+    upload_uniforms();
+    render_buffers();
+
+    gl_state.use_program(shaders->get_program(num_user_buffers));
+    const Buffer buff = get_pass_buffer(num_user_buffers);
+    char* image_block = pass_uniform_data.data() + num_user_buffers * pass_ubo_stride;
+    gl_state.bind_framebuffer(tile_fbo);
+    gl_state.clear_color(buff.clear_color[0], buff.clear_color[1], buff.clear_color[2], 1.f);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    // Bands of tiles from the top of the image down, each from left to right, so the caller can write
+    // out every finished band of rows
+    const int bands = (buff.height + tile_size - 1) / tile_size;
+    for (int band = bands - 1; band >= 0; --band) {
+        const int y = band * tile_size;
+        const int height = std::min(tile_size, buff.height - y);
+        for (int x = 0; x < buff.width; x += tile_size) {
+            const int width = std::min(tile_size, buff.width - x);
+            tile_offset[0] = float(x);
+            tile_offset[1] = float(y);
+            tile_extent[0] = float(width);
+            tile_extent[1] = float(height);
+            shaders->write_pass_uniforms(*this, buff, image_block);
+            gl_state.bind_buffer(GL_UNIFORM_BUFFER, pass_ubo);
+            gl_state.call(glBufferSubData, GL_UNIFORM_BUFFER, GLintptr(num_user_buffers * pass_ubo_stride), GLsizeiptr(shaders->pass_block_size), (const void*)image_block);
+            gl_state.bind_buffer_range(ShaderPrograms::PASS_UNIFORMS_BINDING, pass_ubo, num_user_buffers * pass_ubo_stride, shaders->pass_block_size);
+            gl_state.viewport(width, height);
+            gl_state.call(glClear, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            gl_state.call(glDrawArrays, GL_POINTS, 0, buff.geom_iters);
+            // Tiles are large, so waiting for each one costs little next to rendering it
+            gl_state.call(glReadPixels, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)tile_pixels.data());
+            tile_done(x, y, width, height, tile_pixels.data());
+        }
+    }
+    tile_offset[0] = 0.f;
+    tile_offset[1] = 0.f;
+    tile_extent[0] = 0.f;
+    tile_extent[1] = 0.f;
     frame_counter++;
+    gl_state.begin_frame();
+}
+
+bool Renderer::needs_tiling() const {
+    return window.width > max_render_size || window.height > max_render_size;
+}
+
+Buffer Renderer::get_pass_buffer(int r) const {
+    Buffer buff = r < num_user_buffers ? config.mBuffers[r] : config.mImage;
+    if (buff.is_window_size) {
+        // Window sized buffers and the image follow the dynamic resolution
+        buff.width = int(window.width * dynamic_resolution.get_scale());
+        buff.height = int(window.height * dynamic_resolution.get_scale());
+    }
+    buff.width = std::max(1, int(buff.width * buff.resolution_scale));
+    buff.height = std::max(1, int(buff.height * buff.resolution_scale));
+    return buff;
 }
 
 void Renderer::set_programs(const ShaderPrograms* progs) {
     shaders = progs;
+    // The config may have been reloaded with other uniforms
+    reset_user_uniforms();
+
+    // Size the uniform buffers for the programs' blocks
+    pass_ubo_stride = (shaders->pass_block_size + ubo_offset_alignment - 1) / ubo_offset_alignment * ubo_offset_alignment;
+    frame_uniform_data.assign(shaders->frame_block_size, 0);
+    pass_uniform_data.assign((num_user_buffers + 1) * pass_ubo_stride, 0);
+    glBindBuffer(GL_UNIFORM_BUFFER, frame_ubo);
+    glBufferData(GL_UNIFORM_BUFFER, frame_uniform_data.size(), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, pass_ubo);
+    glBufferData(GL_UNIFORM_BUFFER, pass_uniform_data.size(), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    render_graph = RenderGraph(config.mRender_order, shaders->buffer_reads, shaders->covers_all_pixels, config.mBlend);
+    for (int b = 0; b < num_user_buffers; ++b) {
+        if (!render_graph.live_buffers[b])
+            cout << "Not rendering buffer " << config.mBuffers[b].name << " because its output is never read" << endl;
+
+        // A buffer that doesn't sample itself can draw over the texture others read, so free its second texture
+        if (render_graph.single_texture[b] && fbo_textures[2 * b] != fbo_textures[2 * b + 1]) {
+            glDeleteFramebuffers(1, &fbos[2 * b + 1]);
+            glDeleteTextures(1, &fbo_textures[2 * b + 1]);
+            fbos[2 * b + 1] = fbos[2 * b];
+            fbo_textures[2 * b + 1] = fbo_textures[2 * b];
+            glActiveTexture(GL_TEXTURE0 + FIRST_BUFFER_TEXTURE_UNIT + b);
+            glBindTexture(GL_TEXTURE_2D, fbo_textures[2 * b]);
+            buffers_last_drawn[b] = 0;
+        }
+        // Programs reloaded into this renderer may have started sampling a buffer they draw to
+        else if (!render_graph.single_texture[b] && fbo_textures[2 * b] == fbo_textures[2 * b + 1]) {
+            create_buffer_target(b, fbo_textures[2 * b + 1], fbos[2 * b + 1]);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glBindTexture(GL_TEXTURE_2D, fbo_textures[2 * b + buffers_last_drawn[b]]);
+        }
+    }
+
+    // Constructing the renderer and linking the programs changed gl state behind gl_state's back
+    gl_state.invalidate();
 }
 
-void Renderer::upload_uniforms(const Buffer& buff, const int buff_index) const {
-    // Builtin uniforms
-    for (const auto& u : shaders->builtin_uniforms)
-        u.update(buff_index, buff);
-    int uniform_offset = shaders->builtin_uniforms.size();
-
-    // Point user's samplers to texture units
-    for (int i = 0; i < num_user_buffers; ++i)
-        glUniform1i(shaders->get_uniform_loc(buff_index, uniform_offset + i), i);
-    uniform_offset += num_user_buffers;
-
-    // TODO remove this functionality? simplify.
-    // User's uniforms
-    for (int i = 0; i < config.mUniforms.size(); ++i) {
-        const std::vector<float>& uv = config.mUniforms[i].values;
-        switch (uv.size()) {
-        case 1:
-            glUniform1f(shaders->get_uniform_loc(buff_index, uniform_offset + i), uv[0]);
-            break;
-        case 2:
-            glUniform2f(shaders->get_uniform_loc(buff_index, uniform_offset + i), uv[0], uv[1]);
-            break;
-        case 3:
-            glUniform3f(shaders->get_uniform_loc(buff_index, uniform_offset + i), uv[0], uv[1], uv[2]);
-            break;
-        case 4:
-            glUniform4f(shaders->get_uniform_loc(buff_index, uniform_offset + i), uv[0], uv[1], uv[2], uv[3]);
-            break;
-        }
+void Renderer::set_uniform_store(const UniformStore* store) {
+    uniform_store = store;
+    reset_user_uniforms();
+}
+
+void Renderer::reset_user_uniforms() {
+    user_uniforms.resize(config.mUniforms.size());
+    for (size_t i = 0; i < config.mUniforms.size(); ++i)
+        user_uniforms[i] = config.mUniforms[i].values;
+    if (!uniform_store)
+        return;
+
+    const UniformStore::Snapshot& snapshot = uniform_store->front();
+    for (size_t i = 0; i < config.mUniforms.size(); ++i) {
+        const auto value = snapshot.values.find(config.mUniforms[i].name);
+        if (value == snapshot.values.end())
+            continue;
+        const size_t count = std::min(value->second.size(), user_uniforms[i].size());
+        std::copy(value->second.begin(), value->second.begin() + count, user_uniforms[i].begin());
     }
+    uniform_store_generation = snapshot.generation;
+}
+
+void Renderer::set_fixed_time(float seconds) {
+    fixed_time = seconds;
+}
+
+GLuint Renderer::get_output_framebuffer() const {
+    return output_fbo;
+}
+
+void Renderer::set_output_framebuffer(GLuint fbo) {
+    target_fbo = fbo;
+}
+
+void Renderer::restore_gl_state() {
+    set_blending(config.mBlend);
+    gl_state.invalidate();
+    gl_state.bind_texture(AUDIO_TEXTURE_UNIT, GL_TEXTURE_1D_ARRAY, audio_texture);
+    gl_state.bind_texture(spectrogram_unit, GL_TEXTURE_2D, spectrogram_texture);
+    for (int b = 0; b < num_user_buffers; ++b)
+        gl_state.bind_texture(FIRST_BUFFER_TEXTURE_UNIT + b, GL_TEXTURE_2D, fbo_textures[2 * b + buffers_last_drawn[b]]);
+}
+
+size_t Renderer::get_gpu_memory() const {
+    size_t bytes = 0;
+    for (int b = 0; b < num_user_buffers; ++b) {
+        const int textures = fbo_textures[2 * b] == fbo_textures[2 * b + 1] ? 1 : 2;
+        bytes += textures * buffer_texture_bytes(get_pass_buffer(b));
+    }
+    bytes += AUDIO_TEXTURE_LAYERS * VISUALIZER_BUFSIZE * sizeof(float) + AUDIO_PBO_COUNT * AUDIO_PBO_SIZE;
+    bytes += SPECTROGRAM_LEN * VISUALIZER_BUFSIZE * 2 * sizeof(float);
+    if (image_texture)
+        bytes += 4 * window.width * window.height;
+    if (output_texture)
+        bytes += 4 * window.width * window.height;
+    bytes += 4 * tile_texture_size * tile_texture_size;
+    return bytes;
+}
+
+Renderer::Stats Renderer::get_stats() const {
+    Stats stats;
+    stats.gl_calls = gl_state.get_last_frame_calls();
+    stats.gpu_ms = dynamic_resolution.get_gpu_ms();
+    stats.render_scale = dynamic_resolution.get_scale();
+    return stats;
+}
+
+std::chrono::steady_clock::time_point Renderer::get_audio_capture_time() const {
+    return audio_capture_time;
+}
+
+void Renderer::upload_uniforms() {
+    // The values set from outside change without a reload, as often as every frame
+    if (uniform_store && uniform_store->front().generation != uniform_store_generation)
+        reset_user_uniforms();
+
+    // Every program reads its uniforms from the same two uniform buffers, so the values are
+    // written and uploaded once per frame instead of with glUniform calls for every pass.
+    shaders->write_frame_uniforms(*this, frame_uniform_data.data());
+    for (int r = 0; r <= num_user_buffers; ++r)
+        shaders->write_pass_uniforms(*this, get_pass_buffer(r), pass_uniform_data.data() + r * pass_ubo_stride);
+
+    // glBufferData orphans the buffers so the upload doesn't wait for last frame's draws
+    gl_state.bind_buffer(GL_UNIFORM_BUFFER, frame_ubo);
+    gl_state.call(glBufferData, GL_UNIFORM_BUFFER, GLsizeiptr(frame_uniform_data.size()), (const void*)frame_uniform_data.data(), GL_STREAM_DRAW);
+    gl_state.bind_buffer(GL_UNIFORM_BUFFER, pass_ubo);
+    gl_state.call(glBufferData, GL_UNIFORM_BUFFER, GLsizeiptr(pass_uniform_data.size()), (const void*)pass_uniform_data.data(), GL_STREAM_DRAW);
+    gl_state.bind_buffer_base(ShaderPrograms::FRAME_UNIFORMS_BINDING, frame_ubo);
 }
@@ -1,11 +1,17 @@
 #pragma once
 
 #include <vector>
+#include <functional>
+#include <utility>
 
 #include "ShaderConfig.h"
 #include "Window.h"
 
 #include "AudioProcess.h"
+#include "GLState.h"
+#include "RenderGraph.h"
+#include "DynamicResolution.h"
+#include "UniformStore.h"
 
 class ShaderPrograms;
 
@@ -19,7 +25,42 @@ public:
 	void update(AudioData &data);
 	void update();
 	void render();
+	// Renders the following frames at iTime = seconds instead of the time since the renderer was created,
+	// and keeps the resolution fixed, for rendering offline where frames don't take realtime to render
+	void set_fixed_time(float seconds);
+    // Can be called again with new programs for the same config, the buffers' contents are kept
     void set_programs(const ShaderPrograms* shaders);
+	// Takes the values of the user's uniforms that store has from it instead of from the config, nullptr to stop.
+	// The store is kept when another renderer is moved into this one, like the config.
+	void set_uniform_store(const UniformStore* store);
+	// When the newest audio sample in the uploaded audio textures was captured
+	std::chrono::steady_clock::time_point get_audio_capture_time() const;
+
+	struct Stats {
+		int gl_calls;       // gl calls issued by update() and render() for the last frame
+		float gpu_ms;       // smoothed gpu time of render()
+		float render_scale; // scale window sized buffers and the image are rendered at
+	};
+	Stats get_stats() const;
+	// Framebuffer holding the finished image at the window's size, 0 (the window's) unless the window is headless.
+	// There is none if the window needs tiling.
+	GLuint get_output_framebuffer() const;
+	// Draws the image into fbo, a framebuffer of the window's size, instead of get_output_framebuffer()
+	void set_output_framebuffer(GLuint fbo);
+
+	// Several renderers can share a context, each keeps its textures bound to the same units. Call before
+	// rendering with this renderer after another one rendered or was constructed.
+	void restore_gl_state();
+	// Bytes of the textures and buffers the renderer allocated
+	size_t get_gpu_memory() const;
+
+	// Whether the window is larger than the gpu can render at once, then only render_tiled can render it
+	bool needs_tiling() const;
+	// Renders the image in tiles of at most tile_size x tile_size pixels, for headless windows larger than
+	// a texture or viewport can be. Each finished tile is passed to tile_done with its position in the image
+	// and its RGBA8 pixels, bottom row first. Tiles come in bands of rows from the top of the image down,
+	// each band from left to right. Throws if a window sized buffer is rendered.
+	void render_tiled(int tile_size, const std::function<void(int x, int y, int width, int height, const unsigned char* rgba)>& tile_done);
 
 private:
 	Renderer(Renderer&) = delete;
@@ -29,18 +70,115 @@ private:
 	const ShaderConfig& config;
 	const ShaderPrograms* shaders;
 	const Window& window;
+	GLState gl_state;
 
-	void upload_uniforms(const Buffer& buff, const int buff_index) const;
+	// Writes the uniform blocks of every pass and uploads them to the uniform buffers
+	void upload_uniforms();
+	// Sets user_uniforms to the config's values overridden by the uniform store's
+	void reset_user_uniforms();
+	// The buffer drawn by pass r with the size it renders at, after applying window_size and resolution_scale.
+	// Pass num_user_buffers is the image.
+	Buffer get_pass_buffer(int r) const;
+	// Creates a texture for user buffer b at its render size and a framebuffer with it attached
+	void create_buffer_target(int b, GLuint& tex, GLuint& fbo);
+	// Renders the passes of the user buffers that are due this frame
+	void render_buffers();
+	// Reallocates the textures of the buffers whose size changed with the window or the render scale
+	void resize_buffers();
 
 	std::chrono::steady_clock::time_point start_time;
 	float elapsed_time;
+	// Negative unless set_fixed_time was called
+	float fixed_time;
+
+	std::chrono::steady_clock::time_point audio_capture_time;
+	// AudioData::generation of the uploaded audio, -1 before the first upload
+	int audio_generation;
+	float audio_loudness[4];
+	float audio_peak[2];
+	float audio_spectral[4];
+	float audio_chroma[12];
+
+	// Values of config.mUniforms written to the frame block
+	std::vector<std::vector<float>> user_uniforms;
+	const UniformStore* uniform_store;
+	// Snapshot::generation of the store's values in user_uniforms
+	int uniform_store_generation;
 
 	int frame_counter;
 	int num_user_buffers;
 	std::vector<int> buffers_last_drawn;
-	std::vector<GLuint> fbos; // n * num_user_buffs
-	std::vector<GLuint> fbo_textures; // 2n * num_user_buffs
-	std::vector<GLuint> audio_textures; // 2n * num_user_buffs
+	std::vector<GLuint> fbos; // 2n * num_user_buffs, fbos[i] has fbo_textures[i] attached
+	// Passes that are drawn. Built in set_programs from what the linked programs sample.
+	RenderGraph render_graph;
+	std::vector<GLuint> fbo_textures; // 2n * num_user_buffs, both of a buffer's entries are the same if it never samples itself
+	// Width and height the textures of each user buffer, then of the image, are allocated at. resize_buffers
+	// only reallocates the textures whose size changed, reallocating clears them.
+	std::vector<std::pair<int, int>> texture_sizes;
+
+	// Texture units: the audio texture, then one unit per user buffer, then the spectrogram
+	static const int AUDIO_TEXTURE_UNIT = 0;
+	static const int FIRST_BUFFER_TEXTURE_UNIT = 1;
+	static int get_spectrogram_unit(int num_user_buffers) {
+		return FIRST_BUFFER_TEXTURE_UNIT + num_user_buffers;
+	}
+
+	// 1D array texture with iSoundR, iSoundL, iFreqR, iFreqL in layers 0 to 3
+	static const int AUDIO_TEXTURE_LAYERS = 4;
+	GLuint audio_texture;
+
+	// Ring of pixel buffers the audio texture is uploaded from
+	static const int AUDIO_PBO_COUNT = 3;
+	static const int AUDIO_PBO_SIZE = AUDIO_TEXTURE_LAYERS * VISUALIZER_BUFSIZE * sizeof(float);
+	std::vector<GLuint> audio_pbos;
+	std::vector<float*> audio_pbo_ptrs; // persistent mappings, if supported
+	std::vector<GLsync> audio_pbo_fences; // signaled once the gpu is done reading a pbo
+	int audio_pbo_index;
+	bool audio_pbos_persistent;
+	void delete_audio_pbos();
+
+	// SPECTROGRAM_LEN x VISUALIZER_BUFSIZE texture holding the history of spectra, newest column at spectrogram_offset
+	GLuint spectrogram_texture;
+	int spectrogram_unit;
+	int spectrogram_frames_uploaded;
+	float spectrogram_offset;
+	// Columns copied from AudioData while its mutex is held, uploaded after it is released
+	std::vector<float> spectrogram_staging;
+
+	// Uniform buffers read by every program. The pass buffer holds one block per pass,
+	// pass_ubo_stride bytes apart so each can be bound with glBindBufferRange.
+	GLuint frame_ubo;
+	GLuint pass_ubo;
+	GLint ubo_offset_alignment;
+	int pass_ubo_stride;
+	std::vector<char> frame_uniform_data;
+	std::vector<char> pass_uniform_data;
+
+	DynamicResolution dynamic_resolution;
+	static const int GPU_QUERY_COUNT = 3;
+	GLuint gpu_time_queries[GPU_QUERY_COUNT];
+	int gpu_query_frame;
+	// Image rendered below the window's resolution, 0 if dynamic resolution is disabled
+	GLuint image_fbo;
+	GLuint image_texture;
+	// Window sized image of a headless window, 0 otherwise
+	GLuint output_fbo;
+	GLuint output_texture;
+	// Framebuffer the image is drawn to, output_fbo unless set_output_framebuffer was called
+	GLuint target_fbo;
+	// Smallest of the largest texture and viewport sizes
+	int max_render_size;
+	// Tile render_tiled draws into and reads back, allocated on first use
+	GLuint tile_fbo;
+	GLuint tile_texture;
+	int tile_texture_size;
+	std::vector<unsigned char> tile_pixels;
+	// Position of the tile being drawn in the image, iTileOffset
+	float tile_offset[2];
+	// Size of the tile being drawn, iTileSize, 0 when not rendering in tiles
+	float tile_extent[2];
+	// Texture unit no shader samples, for binding textures that are only rendered to
+	int scratch_unit;
 };
 
 #include "ShaderPrograms.h"
@@ -12,6 +12,8 @@ using std::string;
 using std::to_string;
 #include <set>
 using std::set;
+#include <map>
+using std::map;
 #include <vector>
 using std::vector;
 #include <cctype> // isalpha
@@ -71,6 +73,30 @@ static AudioOptions parse_audio_options(rj::Document& user_conf) {
     return ao;
 }
 
+static DynamicResolutionOptions parse_dynamic_resolution(rj::Document& user_conf) {
+    DynamicResolutionOptions dr;
+    dr.enabled = true;
+
+    rj::Value& dynamic_resolution = user_conf["dynamic_resolution"];
+    if (!dynamic_resolution.IsObject())
+        throw runtime_error("dynamic_resolution is not a json object");
+
+    if (dynamic_resolution.HasMember("target_ms")) {
+        rj::Value& target_ms = dynamic_resolution["target_ms"];
+        if (!target_ms.IsNumber() || target_ms.GetFloat() <= 0.f)
+            throw runtime_error("dynamic_resolution.target_ms must be a positive number");
+        dr.target_ms = target_ms.GetFloat();
+    }
+    if (dynamic_resolution.HasMember("min_scale")) {
+        rj::Value& min_scale = dynamic_resolution["min_scale"];
+        if (!min_scale.IsNumber() || !(min_scale.GetFloat() > 0.f && min_scale.GetFloat() <= 1.f))
+            throw runtime_error("dynamic_resolution.min_scale must be a real number greater than 0 and at most 1");
+        dr.min_scale = min_scale.GetFloat();
+    }
+
+    return dr;
+}
+
 static Buffer parse_image_buffer(rj::Document& user_conf) {
     Buffer image_buffer;
     image_buffer.name = "image";
@@ -162,6 +188,34 @@ static Buffer parse_buffer(rj::Value& buffer, string buffer_name, set<string>& b
         b.geom_iters = b_geom_iters.GetInt();
     }
 
+    if (buffer.HasMember("update_every_n_frames")) {
+        rj::Value& b_update = buffer["update_every_n_frames"];
+        if (!b_update.IsInt() || b_update.GetInt() <= 0)
+            throw runtime_error(b.name + ".update_every_n_frames must be a positive integer");
+        b.update_every_n_frames = b_update.GetInt();
+    }
+
+    if (buffer.HasMember("resolution_scale")) {
+        rj::Value& b_scale = buffer["resolution_scale"];
+        if (!b_scale.IsNumber() || !(b_scale.GetFloat() > 0.f && b_scale.GetFloat() <= 1.f))
+            throw runtime_error(b.name + ".resolution_scale must be a real number greater than 0 and at most 1");
+        b.resolution_scale = b_scale.GetFloat();
+    }
+
+    if (buffer.HasMember("format")) {
+        static const map<string, BufferFormat> formats = {
+            {"RGBA32F", BufferFormat::RGBA32F},
+            {"RGBA16F", BufferFormat::RGBA16F},
+            {"RGBA8", BufferFormat::RGBA8},
+            {"RG16F", BufferFormat::RG16F},
+            {"R32F", BufferFormat::R32F},
+        };
+        rj::Value& b_format = buffer["format"];
+        if (!b_format.IsString() || !formats.count(b_format.GetString()))
+            throw runtime_error(b.name + ".format must be one of \"RGBA32F\", \"RGBA16F\", \"RGBA8\", \"RG16F\" or \"R32F\"");
+        b.format = formats.at(b_format.GetString());
+    }
+
     return b;
 }
 
@@ -226,17 +280,24 @@ static vector<int> parse_render_order(rj::Document& user_conf, vector<Buffer>& b
 
 static void delete_unused_buffers(vector<Buffer>& buffers, vector<int>& render_order) {
     // Only keep the buffers that are used to render
-    set<int> used_buff_indices;
+    // and point render_order at their new indices
+    map<int, int> new_index;
     vector<Buffer> used_buffs;
     for (int i = 0; i < render_order.size(); i++) {
-        if (!used_buff_indices.count(render_order[i])) {
+        if (!new_index.count(render_order[i])) {
+            new_index[render_order[i]] = int(used_buffs.size());
             used_buffs.push_back(buffers[render_order[i]]);
-            used_buff_indices.insert(render_order[i]);
         }
+        render_order[i] = new_index[render_order[i]];
     }
     buffers = used_buffs;
 }
 
+static void check_buffer_count(const vector<Buffer>& buffers) {
+    if (buffers.size() > ShaderConfig::MAX_BUFFERS)
+        throw runtime_error(to_string(buffers.size()) + " buffers are rendered, at most " + to_string(ShaderConfig::MAX_BUFFERS) + " are supported");
+}
+
 Uniform parse_uniform(rj::Value& uniform, string uniform_name, set<string>& uniform_names) {
     Uniform u;
 
@@ -314,6 +375,10 @@ void ShaderConfig::parse_config_from_string(const std::string & json_str) {
         mAudio_ops = parse_audio_options(user_conf);
     }
 
+    if (user_conf.HasMember("dynamic_resolution")) {
+        mDynamic_resolution = parse_dynamic_resolution(user_conf);
+    }
+
     if (user_conf.HasMember("shader_mode")) {
         if (!user_conf["shader_mode"].IsString())
             throw runtime_error("shader_mode must be either \"easy\" or \"advanced\"");
@@ -348,6 +413,7 @@ void ShaderConfig::parse_config_from_string(const std::string & json_str) {
         mBuffers = parse_buffers(user_conf);
         mRender_order = parse_render_order(user_conf, mBuffers);
         delete_unused_buffers(mBuffers, mRender_order);
+        check_buffer_count(mBuffers);
     }
 
     if (user_conf.HasMember("uniforms")) {
@@ -394,6 +460,7 @@ void ShaderConfig::parse_simple_config(const filesys::path & shader_folder) {
         b.name = buffer_name;
         mBuffers.push_back(b);
     }
+    check_buffer_count(mBuffers);
 }
 
 ShaderConfig::ShaderConfig(const filesys::path& shader_folder, const filesys::path& conf_file_path) {
@@ -431,3 +498,20 @@ ShaderConfig::ShaderConfig(const filesys::path& shader_folder, const filesys::pa
 ShaderConfig::ShaderConfig(const string& json_str) {
     parse_config_from_string(json_str);
 }
+
+bool ShaderConfig::same_render_targets(const ShaderConfig& o) const {
+    if (mBuffers.size() != o.mBuffers.size() || mBlend != o.mBlend)
+        return false;
+    if (mDynamic_resolution.enabled != o.mDynamic_resolution.enabled
+        || mDynamic_resolution.target_ms != o.mDynamic_resolution.target_ms
+        || mDynamic_resolution.min_scale != o.mDynamic_resolution.min_scale)
+        return false;
+    for (int i = 0; i < int(mBuffers.size()); ++i) {
+        const Buffer& a = mBuffers[i];
+        const Buffer& b = o.mBuffers[i];
+        if (a.name != b.name || a.is_window_size != b.is_window_size || a.width != b.width || a.height != b.height
+            || a.resolution_scale != b.resolution_scale || a.format != b.format)
+            return false;
+    }
+    return true;
+}
@@ -5,6 +5,15 @@
 #include <array>
 #include "filesystem.h"
 
+// Storage format of a buffer's textures
+enum class BufferFormat {
+    RGBA32F,
+    RGBA16F,
+    RGBA8,
+    RG16F,
+    R32F,
+};
+
 struct Buffer {
     std::string name;
     int width = 0;
@@ -13,6 +22,11 @@ struct Buffer {
     bool uses_default_geometry_shader = true;
     int geom_iters = 1;
     std::array<float, 3> clear_color;
+    // Render only on frames where frame_counter is a multiple of this
+    int update_every_n_frames = 1;
+    // Fraction of width and height (or of the window size) to render at
+    float resolution_scale = 1.f;
+    BufferFormat format = BufferFormat::RGBA32F;
     // Enables building w/ g++-5
     Buffer() { clear_color = {0}; }
 };
@@ -29,11 +43,22 @@ struct AudioOptions {
 	float wave_smooth = .8f;
 };
 
+struct DynamicResolutionOptions {
+	bool enabled = false;
+	// GPU time per frame to aim for
+	float target_ms = 14.f;
+	// Smallest scale window sized buffers and the image are rendered at
+	float min_scale = .5f;
+};
+
 class ShaderConfig {
 public:
     ShaderConfig(const filesys::path& shader_folder, const filesys::path& conf_file_path);
 	ShaderConfig(const std::string &json_str); // used in testing
 
+	// The renderer binds each buffer to its own texture unit next to the audio, spectrogram and scratch units
+	static const int MAX_BUFFERS = 29;
+
 	struct {
 		int width = 400;
 		int height = 300;
@@ -46,6 +71,11 @@ public:
 	std::vector<int> mRender_order; // render_order[n] is an index into buffers
 	std::vector<Uniform> mUniforms;
 	AudioOptions mAudio_ops;
+	DynamicResolutionOptions mDynamic_resolution;
+
+	// Whether a renderer made for o can render this config without reallocating its framebuffers.
+	// Settings the renderer reads every frame, like clear colors or render_order, may differ.
+	bool same_render_targets(const ShaderConfig& o) const;
 
 #ifdef TEST
 	ShaderConfig() {}; // For generating mock instances
@@ -3,77 +3,195 @@ using std::cout;
 using std::endl;
 #include <vector>
 using std::vector;
-#include <fstream>
 #include <string>
 using std::string;
 using std::to_string;
 #include <sstream>
 using std::stringstream;
+#include <cstring>
 #include <stdexcept>
 using std::runtime_error;
 
 #include "ShaderPrograms.h"
 
+// Copies values to dst, where dst is a uniform's offset in a uniform block
+template <typename T>
+static void put(char* dst, std::initializer_list<T> values) {
+    memcpy(dst, values.begin(), values.size() * sizeof(T));
+}
+
+// Sets the std140 offset of each uniform and returns the size of the block
+static int layout_std140(vector<ShaderPrograms::uniform_info>& uniforms) {
+    int offset = 0;
+    for (ShaderPrograms::uniform_info& u : uniforms) {
+        int align;
+        int size;
+        const size_t bracket = u.type.find('[');
+        if (bracket != string::npos) {
+            // Every element of an array is padded to a vec4
+            align = 16;
+            size = 16 * std::stoi(u.type.substr(bracket + 1));
+        }
+        else if (u.type == "vec2") {
+            align = 8;
+            size = 8;
+        }
+        else if (u.type == "vec3" || u.type == "vec4") {
+            align = 16;
+            size = u.type == "vec3" ? 12 : 16;
+        }
+        else { // float, int, bool
+            align = 4;
+            size = 4;
+        }
+        offset = (offset + align - 1) / align * align;
+        u.offset = offset;
+        offset += size;
+    }
+    return (offset + 15) / 16 * 16;
+}
+
 ShaderPrograms::ShaderPrograms(const ShaderConfig& config,
-                               const Renderer& renderer,
                                const Window& window,
-                               const filesys::path& shader_folder) {
-    #define lambda [&](const int p, const Buffer& b)
-    builtin_uniforms = {
-        {"vec2","iMouse",         lambda{ glUniform2f(get_uniform_loc(p, 0), window.mouse.x, window.mouse.y); }},
-        {"bool","iMouseDown",     lambda{ glUniform1i(get_uniform_loc(p, 1), window.mouse.down); } },
-        {"vec2","iMouseDownPos",  lambda{ glUniform2f(get_uniform_loc(p, 2), window.mouse.last_down_x, window.mouse.last_down_y); }},
-        {"vec2","iRes",           lambda{ glUniform2f(get_uniform_loc(p, 3), window.width, window.height); }},
-        {"float","iTime",         lambda{ glUniform1f(get_uniform_loc(p, 4), renderer.elapsed_time); }},
-        {"int","iFrame",          lambda{ glUniform1i(get_uniform_loc(p, 5), renderer.frame_counter); }},
-        {"float","iNumGeomIters", lambda{ glUniform1f(get_uniform_loc(p, 6), float(b.geom_iters)); }},
-        {"sampler1D", "iSoundR",  lambda{ glUniform1i(get_uniform_loc(p, 7), 0); }}, // texture_unit 0
-        {"sampler1D", "iSoundL",  lambda{ glUniform1i(get_uniform_loc(p, 8), 1); }}, // texture_unit 1
-        {"sampler1D", "iFreqR",   lambda{ glUniform1i(get_uniform_loc(p, 9), 2); }}, // texture_unit 2
-        {"sampler1D", "iFreqL",   lambda{ glUniform1i(get_uniform_loc(p, 10), 3); }}, // texture_unit 3
-        {"vec2", "iBuffRes",      lambda{ glUniform2f(get_uniform_loc(p, 11), float(b.width), float(b.height)); }}
+                               const filesys::path& shader_folder,
+                               const ShaderPrograms* previous)
+    : mSources(previous && previous->mSources.folder() == shader_folder ? previous->mSources : ShaderSources(shader_folder)) {
+    // Only the files that changed since previous was built are read again
+    mSources.refresh();
+
+    // Values are written into the uniform buffers once per frame by the renderer, so no glUniform
+    // calls are made per pass. b is the buffer the pass draws to.
+    #define lambda [&](const Renderer& r, const Buffer& b, char* dst)
+    frame_uniforms = {
+        {"vec2","iMouse",         lambda{ put(dst, {window.mouse.x, window.mouse.y}); }},
+        {"bool","iMouseDown",     lambda{ put<int>(dst, {window.mouse.down}); } },
+        {"vec2","iMouseDownPos",  lambda{ put(dst, {window.mouse.last_down_x, window.mouse.last_down_y}); }},
+        {"vec2","iRes",           lambda{ put(dst, {float(window.width), float(window.height)}); }},
+        {"float","iTime",         lambda{ put(dst, {r.elapsed_time}); }},
+        {"int","iFrame",          lambda{ put(dst, {r.frame_counter}); }},
+        {"vec4", "iLoudness",     lambda{ memcpy(dst, r.audio_loudness, sizeof(r.audio_loudness)); }},
+        {"vec2", "iPeak",         lambda{ memcpy(dst, r.audio_peak, sizeof(r.audio_peak)); }},
+        {"vec4", "iSpectral",     lambda{ memcpy(dst, r.audio_spectral, sizeof(r.audio_spectral)); }},
+        {"float[12]", "iChroma",  lambda{ for (int i = 0; i < 12; ++i) put(dst + 16 * i, {r.audio_chroma[i]}); }},
+        {"float", "iSpectrogramOffset",   lambda{ put(dst, {r.spectrogram_offset}); }}
+    };
+    pass_uniforms = {
+        {"vec2", "iBuffRes",      lambda{ put(dst, {float(b.width), float(b.height)}); }},
+        {"float","iNumGeomIters", lambda{ put(dst, {float(b.geom_iters)}); }},
+        {"vec2", "iTileOffset",   lambda{ put(dst, {r.tile_offset[0], r.tile_offset[1]}); }},
+        // The size of the tile being drawn, the whole buffer when not rendering in tiles
+        {"vec2", "iTileSize",     lambda{ put(dst, {r.tile_extent[0] > 0.f ? r.tile_extent[0] : float(b.width),
+                                                   r.tile_extent[1] > 0.f ? r.tile_extent[1] : float(b.height)}); }}
     };
     #undef lambda
 
-	stringstream uniform_header;
-    for (const uniform_info& uniform : builtin_uniforms) {
-        uniform_header << "uniform " << uniform.type << " " << uniform.name << ";\n";
-    }
-    uniform_header << "#define iResolution iRes\n";
-
-	// Put samplers for user buffers in header
-	for (const Buffer& b : config.mBuffers) {
-		uniform_header << "uniform sampler2D i" << b.name << ";\n";
-	}
-
-	// Put user's uniforms in header
-	for (const Uniform& uniform : config.mUniforms) {
+	// Put user's uniforms in the frame block after the builtin uniforms. Their values are the renderer's,
+	// which it can change without the programs being rebuilt.
+	for (size_t i = 0; i < config.mUniforms.size(); ++i) {
+		const Uniform& uniform = config.mUniforms[i];
 		string type;
 		if (uniform.values.size() == 1) // ShaderConfig ensures size is in [1,4]
 			type = "float";
 		else
 			type = "vec" + to_string(uniform.values.size());
 
-		uniform_header << "uniform " << type << " " << uniform.name << ";\n";
+		const size_t size = uniform.values.size() * sizeof(float);
+		frame_uniforms.push_back({type, uniform.name, [i, size](const Renderer& r, const Buffer&, char* dst) {
+			memcpy(dst, r.user_uniforms[i].data(), size);
+		}});
 	}
 
+	frame_block_size = layout_std140(frame_uniforms);
+	pass_block_size = layout_std140(pass_uniforms);
+
+	stringstream uniform_header;
+	uniform_header << "layout(std140) uniform iFrameUniforms {\n";
+	for (const uniform_info& uniform : frame_uniforms)
+		uniform_header << "    " << uniform.type << " " << uniform.name << ";\n";
+	uniform_header << "};\n";
+	uniform_header << "layout(std140) uniform iPassUniforms {\n";
+	for (const uniform_info& uniform : pass_uniforms)
+		uniform_header << "    " << uniform.type << " " << uniform.name << ";\n";
+	uniform_header << "};\n";
+    uniform_header << "#define iResolution iRes\n";
+
+	// Samplers can't be in uniform blocks. Their texture units never change so they are set once below.
+	uniform_header << "uniform sampler1DArray iAudio;\n";
+	uniform_header << "uniform sampler2D iSpectrogram;\n";
+	for (const Buffer& b : config.mBuffers)
+		uniform_header << "uniform sampler2D i" << b.name << ";\n";
+
+    // The audio channels are layers of iAudio. Shaders written for the old sampler1D uniforms keep
+    // working because texture() is overloaded for these stand ins. A sampler can't be aliased to a
+    // layer of another sampler, so functions taking one must take an iAudioChannel instead.
+    uniform_header << "struct iAudioChannel { float layer; };\n";
+    uniform_header << "vec4 texture(iAudioChannel c, float x) { return texture(iAudio, vec2(x, c.layer)); }\n";
+    uniform_header << "#define iSoundR iAudioChannel(0.)\n";
+    uniform_header << "#define iSoundL iAudioChannel(1.)\n";
+    uniform_header << "#define iFreqR iAudioChannel(2.)\n";
+    uniform_header << "#define iFreqL iAudioChannel(3.)\n";
+
+    // When the image is rendered in tiles gl_FragCoord is relative to the tile, so move it to the
+    // pixel of the whole image. A macro doesn't expand inside its own expansion.
+    uniform_header << "#define gl_FragCoord (gl_FragCoord + vec4(iTileOffset, 0., 0.))\n";
+
     // make error message line numbers correspond to line numbers in my text editor
     uniform_header << "#line 0\n";
 
+	// Not in the shader folder, where writing to it would trigger a reload
+	const ProgramCache cache("shader_cache");
 	for (const Buffer& b : config.mBuffers)
-		compile_buffer_shaders(shader_folder, b.name, uniform_header.str(), b.uses_default_geometry_shader);
-	compile_buffer_shaders(shader_folder, config.mImage.name, uniform_header.str(), config.mImage.uses_default_geometry_shader);
-
-	// get uniform locations for each program
-	for (GLuint p : mPrograms) {
-		vector<GLint> uniform_locs;
-        for (const uniform_info& u : builtin_uniforms)
-            uniform_locs.push_back(glGetUniformLocation(p, u.name.c_str()));
-		for (const Buffer& b : config.mBuffers)
-			uniform_locs.push_back(glGetUniformLocation(p, ("i" + b.name).c_str()));
-		for (const Uniform& u : config.mUniforms)
-			uniform_locs.push_back(glGetUniformLocation(p, u.name.c_str()));
-		mUniformLocs.push_back(std::move(uniform_locs));
+		compile_buffer_shaders(shader_folder, b.name, uniform_header.str(), b.uses_default_geometry_shader, cache, previous);
+	compile_buffer_shaders(shader_folder, config.mImage.name, uniform_header.str(), config.mImage.uses_default_geometry_shader, cache, previous);
+
+	// Point each program's samplers at their texture units and its uniform blocks at their binding points.
+	// A block or sampler the shaders never use is optimized out, setting it is then a no op.
+	// Unchanged programs were set up for the same buffers already.
+	for (int n = 0; n < int(mPrograms.size()); ++n) {
+		const GLuint p = mPrograms[n];
+		if (p == 0) {
+			buffer_reads.push_back(previous->buffer_reads[n]);
+			continue;
+		}
+		glUseProgram(p);
+		glUniform1i(glGetUniformLocation(p, "iAudio"), Renderer::AUDIO_TEXTURE_UNIT);
+		glUniform1i(glGetUniformLocation(p, "iSpectrogram"), Renderer::get_spectrogram_unit(int(config.mBuffers.size())));
+		for (int i = 0; i < int(config.mBuffers.size()); ++i)
+			glUniform1i(glGetUniformLocation(p, ("i" + config.mBuffers[i].name).c_str()), Renderer::FIRST_BUFFER_TEXTURE_UNIT + i);
+
+		// Find the buffers this program samples, the linker drops samplers that don't affect the output
+		vector<bool> reads(config.mBuffers.size(), false);
+		GLint num_uniforms = 0;
+		glGetProgramiv(p, GL_ACTIVE_UNIFORMS, &num_uniforms);
+		for (GLint u = 0; u < num_uniforms; ++u) {
+			GLchar name[256];
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(p, u, sizeof(name), &length, &size, &type, name);
+			if (type != GL_SAMPLER_2D)
+				continue;
+			for (int i = 0; i < int(config.mBuffers.size()); ++i)
+				if (string(name, length) == "i" + config.mBuffers[i].name)
+					reads[i] = true;
+		}
+		buffer_reads.push_back(std::move(reads));
+
+		const GLuint frame_block = glGetUniformBlockIndex(p, "iFrameUniforms");
+		if (frame_block != GL_INVALID_INDEX)
+			glUniformBlockBinding(p, frame_block, FRAME_UNIFORMS_BINDING);
+		const GLuint pass_block = glGetUniformBlockIndex(p, "iPassUniforms");
+		if (pass_block != GL_INVALID_INDEX)
+			glUniformBlockBinding(p, pass_block, PASS_UNIFORMS_BINDING);
+	}
+}
+
+void ShaderPrograms::take_unchanged_programs(ShaderPrograms& previous) {
+	for (int i = 0; i < int(mPrograms.size()); ++i) {
+		if (mPrograms[i] == 0) {
+			mPrograms[i] = previous.mPrograms[i];
+			previous.mPrograms[i] = 0;
+		}
 	}
 }
 
@@ -84,7 +202,14 @@ ShaderPrograms & ShaderPrograms::operator=(ShaderPrograms && o) {
 
 	// Move other's shaders
 	mPrograms = std::move(o.mPrograms);
-	mUniformLocs = std::move(o.mUniformLocs);
+	frame_uniforms = std::move(o.frame_uniforms);
+	pass_uniforms = std::move(o.pass_uniforms);
+	frame_block_size = o.frame_block_size;
+	pass_block_size = o.pass_block_size;
+	buffer_reads = std::move(o.buffer_reads);
+	mSource_keys = std::move(o.mSource_keys);
+	mSources = std::move(o.mSources);
+	covers_all_pixels = std::move(o.covers_all_pixels);
 
 	return *this;
 }
@@ -101,16 +226,18 @@ void ShaderPrograms::use_program(int i) const {
 		cout << "i = " + to_string(i) + " is not a program index" << endl;
 }
 
-GLint ShaderPrograms::get_uniform_loc(int program_i, int uniform_i) const {
-	if (program_i >= mPrograms.size()) {
-		cout << "program_i = " + to_string(program_i) + " is not a program index" << endl;
-		return 0;
-	}
-	if (uniform_i >= mUniformLocs[program_i].size()) {
-		cout << "uniform_i = " + to_string(uniform_i) + " is not a uniform index" << endl;
-		return 0;
-	}
-	return mUniformLocs[program_i][uniform_i];
+GLuint ShaderPrograms::get_program(int i) const {
+	return mPrograms[i];
+}
+
+void ShaderPrograms::write_frame_uniforms(const Renderer& renderer, char* dst) const {
+	for (const uniform_info& u : frame_uniforms)
+		u.write(renderer, renderer.config.mImage, dst + u.offset);
+}
+
+void ShaderPrograms::write_pass_uniforms(const Renderer& renderer, const Buffer& buff, char* dst) const {
+	for (const uniform_info& u : pass_uniforms)
+		u.write(renderer, buff, dst + u.offset);
 }
 
 // TODO always report warnings
@@ -136,6 +263,8 @@ bool ShaderPrograms::compile_shader(const GLchar* s, GLuint& sn, GLenum stype) {
 
 bool ShaderPrograms::link_program(GLuint& pn, GLuint vs, GLuint gs, GLuint fs) {
 	pn = glCreateProgram();
+	if (GLEW_ARB_get_program_binary)
+		glProgramParameteri(pn, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glAttachShader(pn, gs);
 	glAttachShader(pn, fs);
 	glAttachShader(pn, vs);
@@ -170,6 +299,10 @@ static const std::string default_geom_shader = R"(
 layout(points) in;
 layout(triangle_strip, max_vertices = 6) out;
 out vec2 geom_p;
+// geom_p of a corner of the viewport, which is only part of the buffer when the image is rendered in tiles
+vec2 corner_p(vec2 p) {
+    return (iTileOffset + (p * .5 + .5) * iTileSize) / iBuffRes;
+}
 void main() {
     /* 1------3
        | \    |
@@ -179,35 +312,44 @@ void main() {
     const vec2 p0 = vec2(-1., -1.);
     const vec2 p1 = vec2(-1., 1.);
     gl_Position = vec4(p0, 0., 1.);
-    geom_p = p0 * .5 + .5;
+    geom_p = corner_p(p0);
     EmitVertex(); // 0
     gl_Position = vec4(p1, 0., 1.);
-    geom_p = p1 * .5 + .5;
+    geom_p = corner_p(p1);
     EmitVertex(); // 1
     gl_Position = vec4(-p1, 0., 1.);
-    geom_p = -p1 * .5 + .5;
+    geom_p = corner_p(-p1);
     EmitVertex(); // 2
     EndPrimitive();
 
     gl_Position = vec4(-p1, 0., 1.);
-    geom_p = -p1 * .5 + .5;
+    geom_p = corner_p(-p1);
     EmitVertex(); // 2
     gl_Position = vec4(p1, 0., 1.);
-    geom_p = p1 * .5 + .5;
+    geom_p = corner_p(p1);
     EmitVertex(); // 1
     gl_Position = vec4(-p0, 0., 1.);
-    geom_p = -p0 * .5 + .5;
+    geom_p = corner_p(-p0);
     EmitVertex(); // 3
     EndPrimitive();
 }
 )";
 
-void ShaderPrograms::compile_buffer_shaders(const filesys::path& shader_folder, const string& buff_name, const string& uniform_header, const bool uses_default_geometry_shader) {
+// Errors give a line as "source string number(line)", name the files that the numbers stand for
+static void print_source_files(const vector<string>& files) {
+	if (files.size() < 2)
+		return;
+	for (int n = 0; n < int(files.size()); ++n)
+		cout << "Source string " << n << " is " << files[n] << endl;
+}
+
+void ShaderPrograms::compile_buffer_shaders(const filesys::path& shader_folder, const string& buff_name, const string& uniform_header, const bool uses_default_geometry_shader, const ProgramCache& cache, const ShaderPrograms* previous) {
 	cout << "Compiling shaders for buffer: " << buff_name << endl;
 
 	filesys::path filepath;
-	std::ifstream shader_file;
 	stringstream geom_str;
+	// Files of the expansion of the geometry shader, by source string number
+	vector<string> geom_files;
 	stringstream frag_str;
 
 	string version_header = R"(
@@ -226,15 +368,12 @@ void ShaderPrograms::compile_buffer_shaders(const filesys::path& shader_folder,
             throw runtime_error("\tGeometry shader does not exist.");
         if (! filesys::is_regular_file(filepath))
             throw runtime_error("\t" + buff_name + ".geom is not a regular file.");
-        shader_file = std::ifstream(filepath.string());
-        if (! shader_file.is_open())
-            throw runtime_error("\tError opening geometry shader.");
+        const ShaderSources::Expansion& geom = mSources.expand(buff_name + ".geom");
+        geom_files = geom.files;
         geom_str << version_header;
         geom_str << uniform_header;
         geom_str << string("layout(points) in;\n #define iGeomIter (float(gl_PrimitiveIDIn)) \n");
-        geom_str << shader_file.rdbuf();
-        if (shader_file.is_open())
-            shader_file.close();
+        geom_str << geom.text;
     }
 
 	filepath = filesys::path(shader_folder / (buff_name + ".frag"));
@@ -242,33 +381,54 @@ void ShaderPrograms::compile_buffer_shaders(const filesys::path& shader_folder,
 		throw runtime_error("\tFragment shader does not exist.");
 	if (! filesys::is_regular_file(filepath))
 		throw runtime_error("\t" + buff_name + ".frag is not a regular file.");
-	shader_file = std::ifstream(filepath.string());
-	if (! shader_file.is_open())
-		throw runtime_error("\tError opening fragment shader.");
+	const ShaderSources::Expansion& frag = mSources.expand(buff_name + ".frag");
 	frag_str << version_header;
 	frag_str << uniform_header;
-	frag_str << shader_file.rdbuf();
+	frag_str << frag.text;
 	if (frag_str.str().find("mainImage", uniform_header.size() + version_header.size()) != std::string::npos)
 		frag_str << "\nout vec4 asdsfasdFDSDf; void main() {mainImage(asdsfasdFDSDf, gl_FragCoord.xy);}";
 
 	string vertex_shader = version_header + string("void main(){}");
+	const bool may_discard = frag_str.str().find("discard", uniform_header.size() + version_header.size()) != std::string::npos;
+	covers_all_pixels.push_back(uses_default_geometry_shader && !may_discard);
+
+	const uint64_t cache_key = cache.key(vertex_shader, geom_str.str(), frag_str.str());
+	mSource_keys.push_back(cache_key);
+	const size_t index = mPrograms.size();
+	if (previous && index < previous->mPrograms.size() && previous->mPrograms[index] && previous->mSource_keys[index] == cache_key) {
+		cout << buff_name + " is unchanged" << endl;
+		mPrograms.push_back(0);
+		return;
+	}
+
+	GLuint program = cache.load(cache_key);
+	if (program) {
+		cout << "Loaded " + buff_name + " from the program cache" << endl;
+		mPrograms.push_back(program);
+		return;
+	}
+
 	GLuint vs, gs, fs;
 	bool ok = compile_shader(vertex_shader.c_str(), vs, GL_VERTEX_SHADER);
 	if (!ok)
 		throw runtime_error("\tInternal error: vertex shader didn't compile.");
 	cout << "Compiling " + buff_name + ".geom" << endl;
 	ok = compile_shader(geom_str.str().c_str(), gs, GL_GEOMETRY_SHADER);
-	if (!ok)
+	if (!ok) {
+		print_source_files(geom_files);
 		throw runtime_error("Failed to compile geometry shader.");
+	}
 	cout << "Compiling " + buff_name + ".frag" << endl;
 	ok = compile_shader(frag_str.str().c_str(), fs, GL_FRAGMENT_SHADER);
-	if (!ok)
+	if (!ok) {
+		print_source_files(frag.files);
 		throw runtime_error("Failed to compile fragment shader.");
-	GLuint program;
+	}
 	ok = link_program(program, vs, gs, fs);
 	if (!ok)
 		throw runtime_error("Failed to link program.");
 
 	mPrograms.push_back(program);
+	cache.store(cache_key, program);
 }
 
@@ -9,6 +9,8 @@
 #include "ShaderConfig.h"
 #include "Renderer.h"
 #include "Window.h"
+#include "ProgramCache.h"
+#include "ShaderSources.h"
 
 // Programs
 // program for buffer n is in mPrograms[n]
@@ -16,23 +18,46 @@
 
 class ShaderPrograms {
 public:
+	// Programs of previous whose generated sources are unchanged are not compiled again. They are taken over
+	// by take_unchanged_programs, so previous can keep rendering while this is constructed on another thread.
 	ShaderPrograms(const ShaderConfig& config,
-        const Renderer& renderer,
         const Window& window,
-        const filesys::path& shader_folder);
+        const filesys::path& shader_folder,
+        const ShaderPrograms* previous = nullptr);
+	// Moves the unchanged programs from the previous that this was constructed with. Must be called before use.
+	void take_unchanged_programs(ShaderPrograms& previous);
 	ShaderPrograms& operator=(ShaderPrograms&&);
 	~ShaderPrograms();
 
 	void use_program(int i) const;
-    //void upload_uniforms(const Buffer& buff, const int buff_index) const;
-	GLint get_uniform_loc(int program_i, int uniform_i) const;
+	GLuint get_program(int i) const;
+
+	// Binding points of the uniform blocks, the same in every program
+	static const GLuint FRAME_UNIFORMS_BINDING = 0;
+	static const GLuint PASS_UNIFORMS_BINDING = 1;
+
+	// Write the std140 data of the blocks, dst must hold frame_block_size or pass_block_size bytes
+	void write_frame_uniforms(const Renderer& renderer, char* dst) const;
+	void write_pass_uniforms(const Renderer& renderer, const Buffer& buff, char* dst) const;
 
     struct uniform_info {
         std::string type;
         std::string name;
-        std::function<void(const int, const Buffer&)> update;
+        // Writes the value to dst, the uniform's location in its block
+        std::function<void(const Renderer&, const Buffer&, char* dst)> write;
+        int offset = 0; // std140 offset in the block
     };
-    std::vector<uniform_info> builtin_uniforms;
+    // Uniforms that are the same for every pass followed by the user's uniforms, in block iFrameUniforms
+    std::vector<uniform_info> frame_uniforms;
+    // Uniforms that depend on the buffer being drawn, in block iPassUniforms
+    std::vector<uniform_info> pass_uniforms;
+    int frame_block_size;
+    int pass_block_size;
+
+	// buffer_reads[p][b]: program p samples user buffer b
+	std::vector<std::vector<bool>> buffer_reads;
+	// covers_all_pixels[p]: program p draws the full screen quad and never discards
+	std::vector<bool> covers_all_pixels;
 
 private:
 	ShaderPrograms(ShaderPrograms&) = delete;
@@ -41,8 +66,13 @@ private:
 
 	bool compile_shader(const GLchar* s, GLuint& sn, GLenum stype);
 	bool link_program(GLuint& pn, GLuint vs, GLuint gs, GLuint fs);
-	void compile_buffer_shaders(const filesys::path& shader_folder, const std::string& buff_name, const std::string& uniform_header, const bool uses_default_geometry_shader);
+	// Loads the program from the cache if it was compiled before, otherwise compiles it and stores it in the cache
+	// A program whose sources are the same as previous's program at the same index is left 0, to be taken over
+	void compile_buffer_shaders(const filesys::path& shader_folder, const std::string& buff_name, const std::string& uniform_header, const bool uses_default_geometry_shader, const ProgramCache& cache, const ShaderPrograms* previous);
 
 	std::vector<GLuint> mPrograms;
-	std::vector<std::vector<GLint>> mUniformLocs;
+	// Hash of the generated sources of each program
+	std::vector<uint64_t> mSource_keys;
+	// Shader files with their includes expanded, kept for the next reload
+	ShaderSources mSources;
 };
@@ -0,0 +1,107 @@
+#include <stdexcept>
+using std::runtime_error;
+
+#include "ShaderReloader.h"
+
+ShaderReloader::ShaderReloader(Window& window, const filesys::path& shader_folder, const filesys::path& shader_config_path)
+    : window(window), shader_folder(shader_folder), shader_config_path(shader_config_path),
+      requested(false), running(false), generation(0), done(false), exiting(false), previous(nullptr) {
+    worker = std::thread(&ShaderReloader::worker_loop, this);
+}
+
+ShaderReloader::~ShaderReloader() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        exiting = true;
+    }
+    cv.notify_all();
+    worker.join();
+    // Programs of a build that was never taken are deleted with the window's context current
+    result = Result();
+}
+
+void ShaderReloader::request(const ShaderPrograms* current) {
+    request(shader_folder, shader_config_path, current);
+}
+
+void ShaderReloader::request(const filesys::path& folder, const filesys::path& config_path, const ShaderPrograms* current) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        requested = true;
+        ++generation;
+        // A finished build may have been built from the programs that the caller is about to pass in
+        // again, so it is never taken once this is called. The worker deletes it on its context.
+        done = false;
+        previous = current;
+        requested_folder = folder;
+        requested_config_path = config_path;
+    }
+    cv.notify_all();
+}
+
+void ShaderReloader::cancel() {
+    std::unique_lock<std::mutex> lock(mtx);
+    requested = false;
+    ++generation;
+    done = false;
+    cv.wait(lock, [this] { return !running; });
+}
+
+bool ShaderReloader::poll(Result& r) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!done || requested || running)
+        return false;
+    r = std::move(result);
+    result = Result();
+    done = false;
+    return true;
+}
+
+void ShaderReloader::worker_loop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+        cv.wait(lock, [this] { return requested || exiting; });
+        if (exiting)
+            return;
+        requested = false;
+        running = true;
+        const unsigned build_generation = generation;
+        const ShaderPrograms* prev = previous;
+        const filesys::path folder = requested_folder;
+        const filesys::path config_path = requested_config_path;
+        // A build that wasn't taken yet is replaced, its programs are deleted on the worker's context
+        Result build = std::move(result);
+        done = false;
+        lock.unlock();
+
+        window.make_shared_context_current(true);
+        build = Result();
+        try {
+            build.config = std::make_unique<ShaderConfig>(folder, config_path);
+            build.programs = std::make_unique<ShaderPrograms>(*build.config, window, folder, prev);
+        }
+        catch (runtime_error& msg) {
+            build = Result();
+            build.error = msg.what();
+        }
+        // The render loop's context may only use the programs once they are completely built
+        glFinish();
+        window.make_shared_context_current(false);
+
+        lock.lock();
+        // Files changed again while compiling or the build was cancelled, a request starts over
+        if (build_generation != generation) {
+            lock.unlock();
+            window.make_shared_context_current(true);
+            build = Result();
+            window.make_shared_context_current(false);
+            lock.lock();
+        }
+        else {
+            result = std::move(build);
+            done = true;
+        }
+        running = false;
+        cv.notify_all();
+    }
+}
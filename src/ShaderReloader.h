@@ -0,0 +1,67 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string>
+
+#include "filesystem.h"
+#include "Window.h"
+#include "ShaderConfig.h"
+#include "ShaderPrograms.h"
+
+// Parses the config and compiles the programs for it on a worker thread, in a context shared with
+// the window's, so that the render loop keeps drawing with the current programs while a reload
+// compiles. The render loop polls for the finished build and swaps it in between frames.
+class ShaderReloader {
+public:
+    ShaderReloader(Window& window, const filesys::path& shader_folder, const filesys::path& shader_config_path);
+    // Waits for a running build to finish
+    ~ShaderReloader();
+
+    // Starts building the programs for the current files. Unchanged programs of current aren't compiled
+    // again, current must stay alive and unchanged until the build is taken by poll() or cancel() returns.
+    // A finished build that wasn't taken yet is thrown away, and so is a running one, which is started
+    // over once it finishes. poll() doesn't return a build while another may still read its current.
+    void request(const ShaderPrograms* current);
+    // Builds the shader in another folder, like a preset of a playlist, current may be nullptr
+    void request(const filesys::path& folder, const filesys::path& config_path, const ShaderPrograms* current);
+
+    struct Result {
+        std::unique_ptr<ShaderConfig> config;
+        std::unique_ptr<ShaderPrograms> programs;
+        // Set instead of config and programs if parsing or compiling failed
+        std::string error;
+    };
+    // Returns true and moves the finished build to result if there is one and no build is requested or running
+    bool poll(Result& result);
+    // Throws away the requested builds, waiting until a running one no longer reads its current
+    void cancel();
+
+private:
+    ShaderReloader(ShaderReloader&) = delete;
+    ShaderReloader& operator=(ShaderReloader&) = delete;
+
+    Window& window;
+    filesys::path shader_folder;
+    filesys::path shader_config_path;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    // Guarded by mtx
+    bool requested;
+    // A build is reading its current
+    bool running;
+    // Incremented by request() and cancel(), a build that finishes under another generation is thrown away
+    unsigned generation;
+    bool done;
+    bool exiting;
+    const ShaderPrograms* previous;
+    filesys::path requested_folder;
+    filesys::path requested_config_path;
+    Result result;
+
+    std::thread worker;
+    void worker_loop();
+};
@@ -0,0 +1,165 @@
+#include <fstream>
+#include <sstream>
+using std::stringstream;
+#include <string>
+using std::string;
+using std::to_string;
+#include <vector>
+using std::vector;
+#include <set>
+#include <algorithm>
+#include <stdexcept>
+using std::runtime_error;
+
+#include "ShaderSources.h"
+
+// Resolves an included path against the folder of the including file, both relative to the shader folder
+static string include_path(const string& including_file, const string& include) {
+    vector<string> parts;
+    auto add_parts = [&parts](const string& path) {
+        size_t start = 0;
+        while (start <= path.size()) {
+            size_t end = path.find('/', start);
+            if (end == string::npos)
+                end = path.size();
+            const string part = path.substr(start, end - start);
+            start = end + 1;
+            if (part.empty() || part == ".")
+                continue;
+            if (part == ".." && !parts.empty() && parts.back() != "..")
+                parts.pop_back();
+            else
+                parts.push_back(part);
+        }
+    };
+    const size_t slash = including_file.rfind('/');
+    if (slash != string::npos)
+        add_parts(including_file.substr(0, slash));
+    add_parts(include);
+
+    string path;
+    for (const string& part : parts)
+        path += (path.empty() ? "" : "/") + part;
+    return path;
+}
+
+// Returns true if line is an #include directive and sets include to the quoted path
+static bool parse_include(const string& line, string& include) {
+    size_t i = line.find_first_not_of(" \t");
+    if (i == string::npos || line[i] != '#')
+        return false;
+    i = line.find_first_not_of(" \t", i + 1);
+    if (i == string::npos || line.compare(i, 7, "include") != 0)
+        return false;
+    i = line.find_first_not_of(" \t", i + 7);
+    const size_t close = i == string::npos ? string::npos : line.find('"', i + 1);
+    if (i == string::npos || line[i] != '"' || close == string::npos)
+        throw runtime_error("expected #include \"file\"");
+    include = line.substr(i + 1, close - i - 1);
+    return true;
+}
+
+ShaderSources::ShaderSources(const filesys::path& shader_folder) : shader_folder(shader_folder) {
+}
+
+const ShaderSources::Expansion& ShaderSources::expand(const string& file) {
+    auto cached = expansions.find(file);
+    if (cached != expansions.end())
+        return cached->second;
+
+    Expansion expansion;
+    vector<string> stack;
+    expand_into(file, expansion, stack);
+    return expansions[file] = std::move(expansion);
+}
+
+void ShaderSources::expand_into(const string& file, Expansion& expansion, vector<string>& stack) {
+    if (std::find(stack.begin(), stack.end(), file) != stack.end())
+        throw runtime_error("\t" + file + " includes itself.");
+    const string source_number = to_string(expansion.files.size());
+    expansion.files.push_back(file);
+    stack.push_back(file);
+
+    // Files are never erased while expanding, so the reference stays valid through the nested reads
+    const string& text = read(file).text;
+    // Line numbers of errors then match the lines in a text editor
+    expansion.text += "#line 0 " + source_number + "\n";
+    int line_number = 0;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == string::npos)
+            end = text.size();
+        const string line = text.substr(pos, end - pos);
+        pos = end + 1;
+        ++line_number;
+
+        string include;
+        bool is_include;
+        try {
+            is_include = parse_include(line, include);
+        }
+        catch (runtime_error& msg) {
+            throw runtime_error("\t" + file + ":" + to_string(line_number) + ": " + msg.what());
+        }
+        if (!is_include) {
+            expansion.text += line;
+            expansion.text += '\n';
+            continue;
+        }
+
+        const string path = include_path(file, include);
+        if (std::find(stack.begin(), stack.end(), path) == stack.end()
+            && std::find(expansion.files.begin(), expansion.files.end(), path) != expansion.files.end()) {
+            // Included before, keep the line so the following lines keep their numbers
+            expansion.text += '\n';
+            continue;
+        }
+        expand_into(path, expansion, stack);
+        // Back to the line after the #include in this file
+        expansion.text += "#line " + to_string(line_number) + " " + source_number + "\n";
+    }
+    stack.pop_back();
+}
+
+const ShaderSources::File& ShaderSources::read(const string& file) {
+    auto cached = files.find(file);
+    if (cached != files.end())
+        return cached->second;
+
+    const filesys::path path = shader_folder / file;
+    // The time is taken before reading so a write during the read is found by the next refresh
+    File f;
+    std::error_code ec;
+    f.write_time = filesys::last_write_time(path, ec);
+    std::ifstream fin(path.string(), std::ios::binary);
+    if (ec || !filesys::is_regular_file(path) || !fin.is_open())
+        throw runtime_error("\tError opening " + file + ".");
+    stringstream ss;
+    ss << fin.rdbuf();
+    f.text = ss.str();
+    return files[file] = std::move(f);
+}
+
+void ShaderSources::refresh() {
+    std::set<string> changed;
+    for (auto it = files.begin(); it != files.end();) {
+        std::error_code ec;
+        const filesys::file_time_type write_time = filesys::last_write_time(shader_folder / it->first, ec);
+        if (ec || write_time != it->second.write_time) {
+            changed.insert(it->first);
+            it = files.erase(it);
+        }
+        else
+            ++it;
+    }
+    if (changed.empty())
+        return;
+    for (auto it = expansions.begin(); it != expansions.end();) {
+        const vector<string>& read_files = it->second.files;
+        if (std::any_of(read_files.begin(), read_files.end(), [&changed](const string& f) { return changed.count(f) != 0; }))
+            it = expansions.erase(it);
+        else
+            ++it;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "filesystem.h"
+
+// Reads shader files and replaces their #include "file" lines with the included file's text.
+//
+// Included paths are relative to the including file. A file is included at most once per expansion,
+// so shared helpers don't need include guards. Each file of an expansion gets its own GLSL source
+// string number and #line directives are put around the included text, so the "n(line)" of a compiler
+// error is a line in files[n].
+//
+// Files and expansions are cached until refresh() finds that a file they read changed on disk, so
+// expanding the sources of every program on a reload only reads the files that changed.
+class ShaderSources {
+public:
+    explicit ShaderSources(const filesys::path& shader_folder);
+
+    struct Expansion {
+        std::string text;
+        // The expanded file followed by the files it included, files[n] has source string number n
+        std::vector<std::string> files;
+    };
+    // file is relative to the shader folder. Throws if a file can't be read or includes itself.
+    const Expansion& expand(const std::string& file);
+
+    // Forgets the files that changed since they were read and the expansions that read them
+    void refresh();
+
+    const filesys::path& folder() const {
+        return shader_folder;
+    }
+
+private:
+    struct File {
+        filesys::file_time_type write_time;
+        std::string text;
+    };
+    filesys::path shader_folder;
+    std::map<std::string, File> files;
+    std::map<std::string, Expansion> expansions;
+
+    const File& read(const std::string& file);
+    // stack holds the files being expanded, to find include cycles
+    void expand_into(const std::string& file, Expansion& expansion, std::vector<std::string>& stack);
+};
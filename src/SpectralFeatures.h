@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <algorithm>
+
+// Summarizes the spectrum of both channels once per analysis frame, so that shaders keyed to
+// timbre or harmony do not have to loop over the iFreq textures for every pixel.
+//
+// centroid: magnitude weighted mean frequency in hz
+// flux: mean increase in magnitude per bin since the previous frame
+// rolloff: frequency in hz below which 85% of the spectrum's energy lies
+// flatness: geometric mean over arithmetic mean of the power spectrum, 0 for tones and 1 for white noise
+// chroma: energy of each pitch class, starting at C, scaled so the largest is 1
+class SpectralFeatures {
+public:
+    // num_bins: number of complex fft outputs, bin_hz: frequency spacing of the bins
+    SpectralFeatures(int num_bins, float bin_hz) : num_bins(num_bins), bin_hz(bin_hz), mags(num_bins, 0.f), prev_mags(num_bins, 0.f), pitch_class(num_bins, -1) {
+        // Only use pitched frequencies, from A0 up to about the top of a piano
+        for (int k = 1; k < num_bins; ++k) {
+            const float f = k * bin_hz;
+            if (f < 27.5f || f > 4200.f)
+                continue;
+            // A is 9 semitones above C
+            const int semitones_from_a = int(std::lround(12.f * std::log2(f / 440.f)));
+            pitch_class[k] = ((semitones_from_a + 9) % 12 + 12) % 12;
+        }
+        std::fill(spectral, spectral + 4, 0.f);
+        std::fill(chroma, chroma + 12, 0.f);
+    }
+
+    // scale is applied to the magnitudes, for example to normalize by the fft length
+    void compute(const std::complex<float>* fft_l, const std::complex<float>* fft_r, float scale) {
+        std::swap(mags, prev_mags);
+
+        float mag_sum = 0.f;
+        float weighted_sum = 0.f;
+        float power_sum = 0.f;
+        float log_power_sum = 0.f;
+        float flux = 0.f;
+        std::fill(chroma, chroma + 12, 0.f);
+        for (int k = 1; k < num_bins; ++k) {
+            const float m = .5f * (std::abs(fft_l[k]) + std::abs(fft_r[k])) * scale;
+            mags[k] = m;
+            mag_sum += m;
+            weighted_sum += m * k * bin_hz;
+            power_sum += m * m;
+            log_power_sum += std::log(m * m + 1e-12f);
+            flux += std::max(0.f, m - prev_mags[k]);
+            if (pitch_class[k] >= 0)
+                chroma[pitch_class[k]] += m * m;
+        }
+
+        float rolloff_k = 0.f;
+        float energy = 0.f;
+        for (int k = 1; k < num_bins; ++k) {
+            energy += mags[k] * mags[k];
+            if (energy >= .85f * power_sum) {
+                rolloff_k = float(k);
+                break;
+            }
+        }
+
+        const int n = num_bins - 1;
+        spectral[0] = mag_sum > 0.f ? weighted_sum / mag_sum : 0.f;
+        spectral[1] = flux / n;
+        spectral[2] = rolloff_k * bin_hz;
+        spectral[3] = power_sum > 0.f ? std::min(1.f, std::exp(log_power_sum / n) / (power_sum / n)) : 0.f;
+
+        const float chroma_max = *std::max_element(chroma, chroma + 12);
+        if (chroma_max > 0.f)
+            for (float& c : chroma)
+                c /= chroma_max;
+    }
+
+    // centroid, flux, rolloff, flatness
+    float spectral[4];
+    float chroma[12];
+
+private:
+    int num_bins;
+    float bin_hz;
+    std::vector<float> mags;
+    std::vector<float> prev_mags;
+    // pitch class of each bin, -1 if the bin is not used for chroma
+    std::vector<int> pitch_class;
+};
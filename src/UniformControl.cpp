@@ -0,0 +1,197 @@
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <stdexcept>
+using std::runtime_error;
+#include <string>
+using std::string;
+using std::to_string;
+#include <vector>
+using std::vector;
+#include <cstring>
+
+#ifdef WINDOWS
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#endif
+
+#include "UniformControl.h"
+
+#ifdef WINDOWS
+using socket_t = SOCKET;
+static const socket_t NO_SOCKET = INVALID_SOCKET;
+static void close_socket(socket_t s) {
+    closesocket(s);
+}
+#else
+using socket_t = int;
+static const socket_t NO_SOCKET = -1;
+static void close_socket(socket_t s) {
+    close(s);
+}
+#endif
+
+static sockaddr_in local_address(int port) {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(uint16_t(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return address;
+}
+
+UniformControl::UniformControl(int port)
+    : sock(std::uintptr_t(NO_SOCKET)), port(port), exiting(false), generation(0) {
+#ifdef WINDOWS
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+        throw runtime_error("Failed to initialize winsock for the control port");
+#endif
+    const sockaddr_in address = local_address(port);
+    const socket_t s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s == NO_SOCKET || bind(s, (const sockaddr*)&address, sizeof(address)) != 0) {
+        if (s != NO_SOCKET)
+            close_socket(s);
+#ifdef WINDOWS
+        WSACleanup();
+#endif
+        throw runtime_error("Failed to listen for uniforms on udp port " + to_string(port));
+    }
+    sock = std::uintptr_t(s);
+
+    thread = std::thread(&UniformControl::receive_loop, this);
+}
+
+UniformControl::~UniformControl() {
+    // Wake the blocked receive with an empty datagram
+    exiting = true;
+    const sockaddr_in address = local_address(port);
+    if (sendto(socket_t(sock), "", 0, 0, (const sockaddr*)&address, sizeof(address)) != 0)
+        cout << "Failed to stop listening on the control port" << endl;
+    thread.join();
+    close_socket(socket_t(sock));
+#ifdef WINDOWS
+    WSACleanup();
+#endif
+}
+
+void UniformControl::receive_loop() {
+    // Largest udp payload
+    vector<char> packet(65507);
+    while (true) {
+        const auto size = recv(socket_t(sock), packet.data(), int(packet.size()), 0);
+        if (exiting)
+            return;
+        if (size <= 0)
+            continue;
+
+        bool changed = false;
+        parse_packet(packet.data(), size_t(size), [&](const string& address, const vector<float>& args) {
+            const string name = address.substr(address.rfind('/') + 1);
+            if (name.empty() || args.empty())
+                return;
+            values[name] = args;
+            changed = true;
+        });
+        if (!changed)
+            continue;
+
+        UniformStore::Snapshot& snapshot = store.back();
+        snapshot.generation = ++generation;
+        snapshot.values = values;
+        store.publish();
+    }
+}
+
+static uint32_t read_u32(const char* p) {
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return uint32_t(u[0]) << 24 | uint32_t(u[1]) << 16 | uint32_t(u[2]) << 8 | uint32_t(u[3]);
+}
+
+static uint64_t read_u64(const char* p) {
+    return uint64_t(read_u32(p)) << 32 | read_u32(p + 4);
+}
+
+// Reads the null terminated string at pos and moves pos past its padding to a multiple of 4 bytes.
+// Returns false if the string doesn't end within size.
+static bool read_string(const char* data, size_t size, size_t& pos, string& s) {
+    if (pos >= size)
+        return false;
+    const char* end = static_cast<const char*>(memchr(data + pos, '\0', size - pos));
+    if (!end)
+        return false;
+    s.assign(data + pos, end);
+    pos += (s.size() / 4 + 1) * 4;
+    return pos <= size;
+}
+
+void UniformControl::parse_packet(const char* data, size_t size,
+    const std::function<void(const string& address, const vector<float>& args)>& message) {
+    // A bundle is its tag and a time tag followed by its elements, each prefixed with its size
+    if (size >= 16 && memcmp(data, "#bundle", 8) == 0) {
+        size_t pos = 16;
+        while (size - pos >= 4) {
+            const size_t element_size = read_u32(data + pos);
+            pos += 4;
+            if (element_size > size - pos)
+                return;
+            parse_packet(data + pos, element_size, message);
+            pos += element_size;
+        }
+        return;
+    }
+
+    size_t pos = 0;
+    string address;
+    string tags;
+    if (size == 0 || data[0] != '/' || !read_string(data, size, pos, address))
+        return;
+    // Without the type tag string of old senders the arguments can't be read
+    if (pos >= size || data[pos] != ',' || !read_string(data, size, pos, tags))
+        return;
+
+    vector<float> args;
+    for (size_t t = 1; t < tags.size(); ++t) {
+        const size_t arg_size = (tags[t] == 'd' || tags[t] == 'h') ? 8 : (tags[t] == 'f' || tags[t] == 'i') ? 4 : 0;
+        if (size - pos < arg_size)
+            return;
+        switch (tags[t]) {
+        case 'f': {
+            const uint32_t bits = read_u32(data + pos);
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            args.push_back(f);
+            break;
+        }
+        case 'd': {
+            const uint64_t bits = read_u64(data + pos);
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            args.push_back(float(d));
+            break;
+        }
+        case 'i':
+            args.push_back(float(int32_t(read_u32(data + pos))));
+            break;
+        case 'h':
+            args.push_back(float(int64_t(read_u64(data + pos))));
+            break;
+        case 'T':
+            args.push_back(1.f);
+            break;
+        case 'F':
+            args.push_back(0.f);
+            break;
+        default:
+            // The sizes of other types' arguments aren't known, so the rest can't be read
+            return;
+        }
+        pos += arg_size;
+    }
+    message(address, args);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "UniformStore.h"
+
+// Sets the user's uniforms from OSC messages sent over UDP to a port on localhost, so lighting desks,
+// controllers and scripts can change them at any rate without shader.json being reloaded.
+//
+// The last part of a message's address is the name of the uniform it sets, so /color and /desk/color both
+// set color, and its float, int, double or boolean arguments are the values. The messages of a bundle are
+// published together. A value stays set until another message changes it, also across reloads.
+class UniformControl {
+public:
+    // Throws if the port can't be bound
+    explicit UniformControl(int port);
+    ~UniformControl();
+
+    // Written by the receiving thread, read by the renderers
+    UniformStore store;
+
+    // Calls message with the address and arguments of each message in an OSC packet, in order.
+    // Malformed messages and messages with arguments of other types are skipped.
+    static void parse_packet(const char* data, size_t size,
+        const std::function<void(const std::string& address, const std::vector<float>& args)>& message);
+
+private:
+    UniformControl(const UniformControl&) = delete;
+    UniformControl& operator=(const UniformControl&) = delete;
+
+    void receive_loop();
+
+    // SOCKET on windows, a file descriptor otherwise
+    std::uintptr_t sock;
+    int port;
+    std::atomic<bool> exiting;
+    std::thread thread;
+
+    // Every value received so far, only used by the receiving thread
+    std::map<std::string, std::vector<float>> values;
+    int generation;
+};
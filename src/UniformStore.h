@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+// Values of the user's uniforms set from outside, passed from one writer thread to the render thread
+// without locks, so neither ever waits for the other.
+//
+// The store holds three snapshots: the writer fills the back one and swaps it with the spare one when it
+// publishes, the reader swaps the spare one with the front one when it takes the latest. With only two
+// the writer would have to wait until the reader is done with the one it wants to fill.
+class UniformStore {
+public:
+    struct Snapshot {
+        // Incremented by every publish, 0 before the first one
+        int generation = 0;
+        // Values by uniform name. A value may have fewer components than the uniform, then only the first ones are set.
+        std::map<std::string, std::vector<float>> values;
+    };
+
+    UniformStore() : spare(1), back_index(2), front_index(0) {}
+
+    // Writer: the snapshot to fill, then publish() it
+    Snapshot& back() {
+        return snapshots[back_index];
+    }
+    void publish() {
+        back_index = spare.exchange(back_index | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Reader: makes the latest published snapshot the front one, returns false if there was no newer one
+    bool take() {
+        if (!(spare.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        front_index = spare.exchange(front_index, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    const Snapshot& front() const {
+        return snapshots[front_index];
+    }
+
+private:
+    UniformStore(const UniformStore&) = delete;
+    UniformStore& operator=(const UniformStore&) = delete;
+
+    static const int INDEX = 3;
+    static const int FRESH = 4;
+
+    Snapshot snapshots[3];
+    // Index of the snapshot neither side uses, with FRESH set if the writer published it since the reader last took one
+    std::atomic<int> spare;
+    int back_index;
+    int front_index;
+};
@@ -3,19 +3,52 @@ using std::cout;
 using std::endl;
 #include <stdexcept>
 using std::runtime_error;
+#include <string>
+using std::string;
 
 #include "Window.h"
 #include "AudioProcess.h" // VISUALIZER_BUFSIZE
 
-Window::Window(int _width, int _height) : width(_width), height(_height), size_changed(true), mouse() {
+Window::Window(int _width, int _height, bool _headless) : width(_width), height(_height), size_changed(true), headless(_headless), skip_presets(0), mouse(), window(nullptr), shared_window(nullptr) {
+#ifdef LINUX
+	egl_display = EGL_NO_DISPLAY;
+	egl_context = EGL_NO_CONTEXT;
+	shared_egl_context = EGL_NO_CONTEXT;
+	if (headless)
+		create_egl_context();
+	else
+		create_glfw_window();
+#else
+	create_glfw_window();
+#endif
+
+	glewExperimental = GL_TRUE;
+	// Without a GLX display glewInit reports an error after it has loaded the core functions, which is all that is used
+	glewInit();
+	const GLubyte* renderer = glGetString(GL_RENDERER);
+	const GLubyte* version = glGetString(GL_VERSION);
+	if (renderer == nullptr) throw runtime_error("OpenGL functions failed to load.");
+	cout << "Renderer: " << renderer << endl;
+	cout << "OpenGL version supported "<< version << endl;
+
+	if (window)
+		glfwSwapInterval(0);
+}
+
+void Window::create_glfw_window() {
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	//glfwWindowHint(GLFW_DECORATED, false);
+	// Where EGL isn't used a headless window is a hidden one
+	glfwWindowHint(GLFW_VISIBLE, !headless);
 
 	window = glfwCreateWindow(width, height, "Music Visualizer", NULL, NULL);
 	if (window == NULL) throw runtime_error("GLFW window creation failed.");
+	glfwWindowHint(GLFW_VISIBLE, false);
+	shared_window = glfwCreateWindow(1, 1, "", NULL, window);
+	if (shared_window == NULL) throw runtime_error("GLFW shared context creation failed.");
 
 	glfwMakeContextCurrent(window);
 	glfwSetWindowUserPointer(window, this);
@@ -35,21 +68,69 @@ Window::Window(int _width, int _height) : width(_width), height(_height), size_c
 	glfwSetCursorPosCallback(window, cursor_pos_func);
 	glfwSetMouseButtonCallback(window, mouse_button_func);
 	glfwSetWindowSizeCallback(window, window_size_func);
+}
 
-	glewExperimental = GL_TRUE;
-	glewInit();
-	const GLubyte* renderer = glGetString(GL_RENDERER);
-	const GLubyte* version = glGetString(GL_VERSION);
-	cout << "Renderer: " << renderer << endl;
-	cout << "OpenGL version supported "<< version << endl;
+#ifdef LINUX
+void Window::create_egl_context() {
+	// The surfaceless platform needs neither a display server nor a gpu
+	auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display)
+		egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	if (egl_display == EGL_NO_DISPLAY)
+		egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, nullptr, nullptr))
+		throw runtime_error("EGL display initialization failed.");
+
+	const char* extensions = eglQueryString(egl_display, EGL_EXTENSIONS);
+	if (extensions == nullptr || string(extensions).find("EGL_KHR_surfaceless_context") == string::npos)
+		throw runtime_error("EGL_KHR_surfaceless_context is not supported.");
+	if (!eglBindAPI(EGL_OPENGL_API))
+		throw runtime_error("EGL does not support OpenGL.");
 
-	glfwSwapInterval(0);
+	const EGLint config_attribs[] = {
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint num_configs = 0;
+	if (!eglChooseConfig(egl_display, config_attribs, &config, 1, &num_configs) || num_configs == 0)
+		throw runtime_error("No EGL config supports OpenGL.");
+
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	egl_context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, context_attribs);
+	if (egl_context == EGL_NO_CONTEXT)
+		throw runtime_error("EGL context creation failed.");
+	shared_egl_context = eglCreateContext(egl_display, config, egl_context, context_attribs);
+	if (shared_egl_context == EGL_NO_CONTEXT)
+		throw runtime_error("EGL shared context creation failed.");
+	if (!eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context))
+		throw runtime_error("Making the EGL context current failed.");
 }
+#endif
 
 Window::~Window() {
 	// If we're being destroyed, then the app is shutting down.
-	glfwDestroyWindow(window);
-	glfwTerminate();
+#ifdef LINUX
+	if (egl_display != EGL_NO_DISPLAY) {
+		eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (shared_egl_context != EGL_NO_CONTEXT)
+			eglDestroyContext(egl_display, shared_egl_context);
+		if (egl_context != EGL_NO_CONTEXT)
+			eglDestroyContext(egl_display, egl_context);
+		eglTerminate(egl_display);
+	}
+#endif
+	if (window) {
+		if (shared_window)
+			glfwDestroyWindow(shared_window);
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
 }
 
 void Window::window_size_callback(int _width, int _height) {
@@ -83,18 +164,40 @@ void Window::keyboard_callback(int key, int scancode, int action, int mods) {
 		glfwSetWindowShouldClose(window, GL_TRUE);
 	if (key == GLFW_KEY_Q && action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, GL_TRUE);
+	if (key == GLFW_KEY_RIGHT && action == GLFW_PRESS)
+		skip_presets++;
+	if (key == GLFW_KEY_LEFT && action == GLFW_PRESS)
+		skip_presets--;
 }
 
 bool Window::is_alive() {
+	// Nothing closes a headless window, the caller decides how many frames to render
+	if (headless)
+		return true;
 	return !glfwWindowShouldClose(window); 
 }
 
 void Window::poll_events() {
 	// size_changed should've been noticed by renderer this frame, so reset
 	size_changed = false;
-	glfwPollEvents();
+	if (window)
+		glfwPollEvents();
+}
+
+void Window::make_shared_context_current(bool current) {
+#ifdef LINUX
+	if (egl_display != EGL_NO_DISPLAY) {
+		eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, current ? shared_egl_context : EGL_NO_CONTEXT);
+		return;
+	}
+#endif
+	glfwMakeContextCurrent(current ? shared_window : NULL);
 }
 
 void Window::swap_buffers() {
-	glfwSwapBuffers(window);
+	// The image of a headless window stays in the renderer's output framebuffer
+	if (headless)
+		glFlush();
+	else
+		glfwSwapBuffers(window);
 }
\ No newline at end of file
@@ -2,19 +2,33 @@
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#ifdef LINUX
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 class Window {
 public:
-    Window(int width, int height);
+    // A headless window has no surface to present to. Its context is created without a display,
+    // on linux through EGL's surfaceless platform so it works with software renderers like Mesa's
+    // llvmpipe, and the renderer draws the image into an offscreen framebuffer of width x height.
+    Window(int width, int height, bool headless = false);
     ~Window();
 
     void poll_events();
     void swap_buffers();
     bool is_alive();
+    // Makes a second context, which shares programs and other objects with the window's, current on
+    // the calling thread, or releases it if current is false. Lets another thread compile shaders.
+    // Only one thread may have it current at a time.
+    void make_shared_context_current(bool current);
 
     int width;
     int height;
     bool size_changed;
+    const bool headless;
+    // Presets to move forward by, or back if negative, added to by the arrow keys and reset by the playlist
+    int skip_presets;
     struct {
         float x;
         float y;
@@ -24,7 +38,15 @@ public:
     } mouse;
 
 private:
-    GLFWwindow* window;
+    GLFWwindow* window; // nullptr if the context was created through EGL
+    GLFWwindow* shared_window; // hidden, only for its context
+    void create_glfw_window();
+#ifdef LINUX
+    EGLDisplay egl_display;
+    EGLContext egl_context;
+    EGLContext shared_egl_context;
+    void create_egl_context();
+#endif
 
     void window_size_callback(int width, int height);
     void cursor_position_callback(double xpos, double ypos);
@@ -10,6 +10,12 @@ using ClockT = std::chrono::steady_clock;
 using std::ifstream;
 #include <stdexcept>
 using std::runtime_error;
+#include <memory>
+#include <algorithm>
+#include <set>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
 
 #include "filesystem.h"
 #include "FileWatcher.h"
@@ -18,8 +24,16 @@ using std::runtime_error;
 #include "ShaderConfig.h"
 #include "ShaderPrograms.h"
 #include "Renderer.h"
+#include "LatencyHistogram.h"
+#include "ShaderReloader.h"
+#include "FrameExporter.h"
+#include "ManualClock.h"
+#include "Playlist.h"
+#include "UniformControl.h"
 
 #include "AudioProcess.h"
+#include "AudioRecorder.h"
+#include "AudioStreams/WavAudioStream.h"
 #ifdef WINDOWS
 #include "AudioStreams/WindowsAudioStream.h"
 #include "AudioStreams/ProceduralAudioStream.h"
@@ -29,13 +43,216 @@ using AudioStreamT = WindowsAudioStream;
 #include "AudioStreams/LinuxAudioStream.h"
 using AudioStreamT = LinuxAudioStream;
 #endif
-using AudioProcessT = AudioProcess<ClockT, AudioStreamT>;
 
 // TODO rename to shader player (like vmware player) ?
 // TODO adding builtin uniforms should be as easy as adding an entry to a list
 
+// Runs the render loop until the window is closed or frame_limit frames were rendered, if it isn't 0.
+// Templated on the stream so that AudioProcess calls the stream directly whichever stream is used.
+// If playlist_presets isn't empty they are played, starting with the built first one.
+// If control isn't nullptr the user's uniforms take the values it receives.
+template <typename AudioStreamT>
+static void run(AudioStreamT& audio_stream,
+                int frame_limit,
+                AudioRecorder* recorder,
+                const filesys::path& shader_folder,
+                const filesys::path& shader_config_path,
+                FileWatcher& watcher,
+                UniformControl* control,
+                const std::vector<filesys::path>& playlist_presets,
+                const Playlist::Options& playlist_options,
+                ShaderConfig* shader_config,
+                ShaderPrograms* shader_programs,
+                Renderer* renderer,
+                Window* window) {
+    AudioProcess<ClockT, AudioStreamT> audio_process{audio_stream, shader_config->mAudio_ops};
+    audio_process.set_recorder(recorder);
+    std::thread audio_thread = std::thread(&AudioProcess<ClockT, AudioStreamT>::start, &audio_process);
+    if (shader_config->mAudio_enabled)
+        audio_process.start_audio_system();
+
+    // Reloads are compiled by the reloader's thread while the current programs keep rendering, and swapped
+    // in between frames. Only what the changed files affect is rebuilt: programs whose sources didn't change
+    // are kept, and so is the renderer, with the contents of its buffers, unless the buffers' sizes or formats
+    // changed. The config is always reparsed because that is cheap, and a new .geom file changes it too.
+    ShaderReloader reloader(*window, shader_folder, shader_config_path);
+    auto apply_audio_options = [&]() {
+        if (shader_config->mAudio_enabled) {
+            audio_process.start_audio_system();
+            audio_process.set_audio_options(shader_config->mAudio_ops);
+        }
+        else {
+            audio_process.pause_audio_system();
+        }
+    };
+    auto update_shader = [&](ShaderReloader::Result& reload) {
+        if (!reload.error.empty()) {
+            cout << reload.error << endl;
+            cout << "Failed to update shaders." << endl << endl;
+            return;
+        }
+        reload.programs->take_unchanged_programs(*shader_programs);
+        if (reload.config->same_render_targets(*shader_config)) {
+            // The renderer reads the config through a reference to *shader_config, so it sees the new one
+            *shader_config = *reload.config;
+            *shader_programs = std::move(*reload.programs);
+            renderer->set_programs(shader_programs);
+        }
+        else {
+            Renderer new_renderer(*reload.config, *window);
+            *shader_config = *reload.config;
+            *shader_programs = std::move(*reload.programs);
+            *renderer = std::move(new_renderer);
+            renderer->set_programs(shader_programs);
+        }
+        apply_audio_options();
+        cout << "Successfully updated shaders." << endl << endl;
+    };
+
+    // The playlist owns the presets and drives the reloader, the pointers follow the shown preset
+    std::unique_ptr<Playlist> playlist;
+    if (!playlist_presets.empty())
+        playlist = std::make_unique<Playlist>(playlist_presets, playlist_options, *window, reloader,
+                                              std::unique_ptr<ShaderConfig>(shader_config),
+                                              std::unique_ptr<ShaderPrograms>(shader_programs),
+                                              std::unique_ptr<Renderer>(renderer));
+    if (control) {
+        if (playlist)
+            playlist->set_uniform_store(&control->store);
+        else
+            renderer->set_uniform_store(&control->store);
+    }
+
+    // How old the newest audio on screen is when the frame showing it is swapped in
+    LatencyHistogram audio_latency;
+    const auto latency_report_interval = std::chrono::seconds(30);
+    auto last_latency_report = ClockT::now();
+
+    int frames = 0;
+    const auto run_start = ClockT::now();
+    while (window->is_alive() && (frame_limit == 0 || frames < frame_limit)) {
+        const std::set<string> changed_files = watcher.take_changed_files();
+        if (!changed_files.empty()) {
+            cout << "Updating shaders:";
+            for (const string& file : changed_files)
+                cout << " " << file;
+            cout << endl;
+            if (playlist)
+                playlist->files_changed(changed_files);
+            else
+                reloader.request(shader_programs);
+        }
+        if (playlist) {
+            if (playlist->update()) {
+                shader_config = &playlist->config();
+                shader_programs = &playlist->programs();
+                renderer = &playlist->renderer();
+                apply_audio_options();
+            }
+        }
+        else {
+            ShaderReloader::Result reload;
+            if (reloader.poll(reload))
+                update_shader(reload);
+        }
+        // The renderers read the newest values set from outside when they upload their uniforms
+        if (control)
+            control->store.take();
+        auto now = ClockT::now();
+        if (playlist) {
+            playlist->render(audio_process.get_audio_data());
+        }
+        else {
+            renderer->update(audio_process.get_audio_data());
+            renderer->render();
+        }
+        window->swap_buffers();
+        if (shader_config->mAudio_enabled && renderer->get_audio_capture_time() != ClockT::time_point())
+            audio_latency.add(ClockT::now() - renderer->get_audio_capture_time());
+        if (ClockT::now() - last_latency_report > latency_report_interval) {
+            audio_latency.report(cout);
+            const Renderer::Stats stats = renderer->get_stats();
+            cout << "GL calls per frame: " << stats.gl_calls << ", GPU time: " << stats.gpu_ms
+                 << "ms, render scale: " << stats.render_scale << endl;
+            last_latency_report = ClockT::now();
+        }
+        window->poll_events();
+        frames++;
+        // Nothing is shown headless, so frames are rendered as fast as possible
+        if (!window->headless)
+            std::this_thread::sleep_for(std::chrono::microseconds(16666) - (ClockT::now() - now));
+    }
+
+    audio_latency.report(cout);
+    const float run_seconds = std::chrono::duration<float>(ClockT::now() - run_start).count();
+    cout << "Rendered " << frames << " frames at " << frames / std::max(run_seconds, 1e-6f) << " fps" << endl;
+
+    audio_process.exit_audio_system();
+    audio_thread.join();
+}
+
+static const int DEFAULT_TILE_SIZE = 4096;
+
+// Renders the audio file to a video as fast as the gpu allows. AudioProcess runs on a ManualClock that
+// only advances with the audio fed to it, sample_rate / fps frames per video frame, so the video
+// stays in sync with the file however long each frame takes to render.
+// Frames are rendered in tiles of tile_size if it isn't 0 or if they are too large to render at once.
+static void export_video(const filesys::path& audio_path,
+                         const string& export_path,
+                         FrameExporter::Format format,
+                         int fps,
+                         int frame_limit,
+                         int tile_size,
+                         ShaderConfig* shader_config,
+                         Renderer* renderer,
+                         Window* window) {
+    WavAudioStream audio_stream(audio_path);
+    AudioProcess<ManualClock, WavAudioStream> audio_process{audio_stream, shader_config->mAudio_ops};
+    if (tile_size == 0 && renderer->needs_tiling())
+        tile_size = DEFAULT_TILE_SIZE;
+    FrameExporter exporter(export_path, format, window->width, window->height, fps, tile_size);
+    const long long sample_rate = audio_stream.get_sample_rate();
+
+    long long frames_fed = 0;
+    int frame = 0;
+    const auto export_start = ClockT::now();
+    while (!audio_stream.at_end() && (frame_limit == 0 || frame < frame_limit)) {
+        // Feed the audio up to the end of this video frame
+        const long long frames_due = (frame + 1) * sample_rate / fps;
+        while (frames_fed < frames_due) {
+            audio_process.step();
+            frames_fed += ABL;
+            const ManualClock::duration fed_time(frames_fed * 1000000000 / sample_rate);
+            ManualClock::advance(fed_time - ManualClock::now().time_since_epoch());
+        }
+
+        renderer->set_fixed_time(frame / float(fps));
+        renderer->update(audio_process.get_audio_data());
+        if (tile_size) {
+            renderer->render_tiled(tile_size, [&](int x, int y, int width, int height, const unsigned char* rgba) {
+                exporter.add_tile(x, y, width, height, rgba);
+            });
+        }
+        else {
+            renderer->render();
+            exporter.capture(renderer->get_output_framebuffer());
+        }
+        window->poll_events();
+        frame++;
+        if (frame % (10 * fps) == 0)
+            cout << "Exported " << frame / fps << "s of video" << endl;
+    }
+    exporter.finish();
+
+    const float export_seconds = std::chrono::duration<float>(ClockT::now() - export_start).count();
+    cout << "Exported " << exporter.get_frames_written() << " frames at "
+         << exporter.get_frames_written() / std::max(export_seconds, 1e-6f) << " fps" << endl;
+}
+
 #if defined(WINDOWS) && defined(DEBUG)
 int WinMain() {
+    int argc = __argc;
+    char** argv = __argv;
 #else
 int main(int argc, char* argv[]) {
 #endif
@@ -44,7 +261,99 @@ int main(int argc, char* argv[]) {
     // TODO should this be here or in ShaderConfig?
     filesys::path shader_config_path = shader_folder / "shader.json";
 
-    FileWatcher watcher(shader_folder);
+    // --record <file> saves the captured audio, --replay <file> visualizes a recording instead of the system audio
+    // --headless <width>x<height> renders without a display, --frames <n> stops after n frames
+    // --export <file or |command> renders the --replay file to a video at --fps <n>, as y4m or pam if the name ends in
+    // .y4m or .pam or --export-format y4m or pam is given, otherwise as raw rgba. --tile-size <n> renders it in tiles.
+    // --playlist <folder> plays the presets in its subfolders, each for --interval <seconds> if given, with
+    // --crossfade <seconds> between them. --preload <n> presets are built ahead while their render targets
+    // fit in --preload-budget <megabytes>.
+    // --osc-port <port> sets the uniforms of shader.json from OSC messages sent to that udp port on localhost.
+    filesys::path record_path;
+    filesys::path replay_path;
+    bool headless = false;
+    int headless_width = 0;
+    int headless_height = 0;
+    int frame_limit = 0;
+    string export_path;
+    string export_format;
+    int export_fps = 60;
+    int tile_size = 0;
+    filesys::path playlist_folder;
+    Playlist::Options playlist_options;
+    int osc_port = 0;
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (string(argv[i]) == "--record")
+            record_path = argv[++i];
+        else if (string(argv[i]) == "--replay")
+            replay_path = argv[++i];
+        else if (string(argv[i]) == "--headless") {
+            headless = true;
+            if (sscanf(argv[++i], "%dx%d", &headless_width, &headless_height) != 2 || headless_width <= 0 || headless_height <= 0) {
+                cout << "--headless expects a size like 1920x1080" << endl;
+                return 1;
+            }
+        }
+        else if (string(argv[i]) == "--frames")
+            frame_limit = std::max(0, atoi(argv[++i]));
+        else if (string(argv[i]) == "--export")
+            export_path = argv[++i];
+        else if (string(argv[i]) == "--export-format")
+            export_format = argv[++i];
+        else if (string(argv[i]) == "--fps")
+            export_fps = std::max(1, atoi(argv[++i]));
+        else if (string(argv[i]) == "--tile-size")
+            tile_size = std::max(0, atoi(argv[++i]));
+        else if (string(argv[i]) == "--playlist")
+            playlist_folder = argv[++i];
+        else if (string(argv[i]) == "--interval")
+            playlist_options.interval = std::max(0.f, float(atof(argv[++i])));
+        else if (string(argv[i]) == "--crossfade")
+            playlist_options.crossfade = std::max(0.f, float(atof(argv[++i])));
+        else if (string(argv[i]) == "--preload")
+            playlist_options.preload = std::max(0, atoi(argv[++i]));
+        else if (string(argv[i]) == "--preload-budget")
+            playlist_options.memory_budget = size_t(std::max(0, atoi(argv[++i]))) << 20;
+        else if (string(argv[i]) == "--osc-port")
+            osc_port = atoi(argv[++i]);
+    }
+    if (!export_path.empty() && replay_path.empty()) {
+        cout << "--export needs the audio file to render given with --replay" << endl;
+        return 1;
+    }
+
+    std::vector<filesys::path> playlist_presets;
+    if (!playlist_folder.empty()) {
+        if (!export_path.empty()) {
+            cout << "--playlist can't be exported, export the presets one at a time" << endl;
+            return 1;
+        }
+        playlist_presets = Playlist::find_presets(playlist_folder);
+        if (playlist_presets.empty()) {
+            cout << "No presets in " << playlist_folder.string() << ", a preset is a folder with an image.frag" << endl;
+            return 1;
+        }
+        // The first preset is built like a single shader, the playlist builds the others
+        shader_folder = playlist_presets[0];
+        shader_config_path = shader_folder / "shader.json";
+    }
+    FileWatcher watcher(playlist_folder.empty() ? shader_folder : playlist_folder);
+
+    // Exports render the shader.json values, the control only changes what is shown live
+    std::unique_ptr<UniformControl> uniform_control;
+    if (osc_port != 0 && export_path.empty()) {
+        if (osc_port < 0 || osc_port > 65535) {
+            cout << "--osc-port expects a port between 1 and 65535" << endl;
+            return 1;
+        }
+        try {
+            uniform_control = std::make_unique<UniformControl>(osc_port);
+        }
+        catch (runtime_error &msg) {
+            cout << msg.what() << endl;
+            return 1;
+        }
+    }
 
     ShaderConfig *shader_config = nullptr;
     ShaderPrograms *shader_programs = nullptr;
@@ -54,9 +363,13 @@ int main(int argc, char* argv[]) {
     while (!(shader_config && shader_programs && window)) {
         try {
             shader_config = new ShaderConfig(shader_folder, shader_config_path);
-            window = new Window(shader_config->mInitWinSize.width, shader_config->mInitWinSize.height);
+            if (headless)
+                window = new Window(headless_width, headless_height, true);
+            else
+                // Exports are always rendered offscreen, at the configured window size unless --headless gives one
+                window = new Window(shader_config->mInitWinSize.width, shader_config->mInitWinSize.height, !export_path.empty());
             renderer = new Renderer(*shader_config, *window);
-            shader_programs = new ShaderPrograms(*shader_config, *renderer, *window, shader_folder);
+            shader_programs = new ShaderPrograms(*shader_config, *window, shader_folder);
             renderer->set_programs(shader_programs);
         }
         catch (runtime_error &msg) {
@@ -79,52 +392,38 @@ int main(int argc, char* argv[]) {
     }
     cout << "Successfully compiled shaders." << endl;
 
-    //AudioStreamT audio_stream(); // Most Vexing Parse
-    AudioStreamT audio_stream;
-    AudioProcessT audio_process{audio_stream, shader_config->mAudio_ops};
-    std::thread audio_thread = std::thread(&AudioProcess<ClockT, AudioStreamT>::start, &audio_process);
-    if (shader_config->mAudio_enabled)
-        audio_process.start_audio_system();
+    std::unique_ptr<AudioRecorder> recorder;
+    if (!record_path.empty())
+        recorder = std::make_unique<AudioRecorder>(record_path, 48000);
 
-    auto update_shader = [&]() {
-        cout << "Updating shaders." << endl;
+    if (!export_path.empty()) {
+        const string extension = filesys::path(export_path).extension().string();
+        FrameExporter::Format format = FrameExporter::Format::RGBA;
+        if (export_format == "y4m" || (export_format.empty() && extension == ".y4m"))
+            format = FrameExporter::Format::Y4M;
+        else if (export_format == "pam" || (export_format.empty() && extension == ".pam"))
+            format = FrameExporter::Format::PAM;
         try {
-            ShaderConfig new_shader_config(shader_folder, shader_config_path);
-            Renderer new_renderer(new_shader_config, *window);
-            ShaderPrograms new_shader_programs(new_shader_config, new_renderer, *window, shader_folder);
-            *shader_config = new_shader_config;
-            *shader_programs = std::move(new_shader_programs);
-            *renderer = std::move(new_renderer);
-            renderer->set_programs(shader_programs);
+            export_video(replay_path, export_path, format, export_fps, frame_limit, tile_size, shader_config, renderer, window);
         }
         catch (runtime_error &msg) {
             cout << msg.what() << endl;
-            cout << "Failed to update shaders." << endl << endl;
-            return;
+            return 1;
         }
-        if (shader_config->mAudio_enabled) {
-            audio_process.start_audio_system();
-            audio_process.set_audio_options(shader_config->mAudio_ops);
-        }
-        else {
-            audio_process.pause_audio_system();
-        }
-        cout << "Successfully updated shaders." << endl << endl;
-    };
-
-    while (window->is_alive()) {
-        if (watcher.files_changed())
-            update_shader();
-        auto now = ClockT::now();
-        renderer->update(audio_process.get_audio_data());
-        renderer->render();
-        window->swap_buffers();
-        window->poll_events();
-        std::this_thread::sleep_for(std::chrono::microseconds(16666) - (ClockT::now() - now));
     }
-
-    audio_process.exit_audio_system();
-    audio_thread.join();
+    else if (renderer->needs_tiling()) {
+        cout << "The window is larger than the gpu can render at once, only --export can render it in tiles" << endl;
+        return 1;
+    }
+    else if (!replay_path.empty()) {
+        WavAudioStream audio_stream(replay_path, true);
+        run(audio_stream, frame_limit, recorder.get(), shader_folder, shader_config_path, watcher, uniform_control.get(), playlist_presets, playlist_options, shader_config, shader_programs, renderer, window);
+    }
+    else {
+        //AudioStreamT audio_stream(); // Most Vexing Parse
+        AudioStreamT audio_stream;
+        run(audio_stream, frame_limit, recorder.get(), shader_folder, shader_config_path, watcher, uniform_control.get(), playlist_presets, playlist_options, shader_config, shader_programs, renderer, window);
+    }
 
     return 0;
 }
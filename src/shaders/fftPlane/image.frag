@@ -25,7 +25,7 @@ float dtl(vec3 p, vec3 lo, vec3 ld, float l) {
     return length(x - ld * t);
 }
 
-float tx(sampler1D tex, float x) {
+float tx(iAudioChannel tex, float x) {
     return .333*texture(tex, x).r +
            .333*texture(tex, x+.005).r +
            .333*texture(tex, x-.005).r;
@@ -1,13 +1,10 @@
 in vec2 geom_p;
 out vec4 c;
 
-float hash(float p) {
-	vec3 p3  = fract(vec3(p) * 443.8975);
-    p3 += dot(p3, p3.yzx + 19.19);
-    return fract((p3.x + p3.y) * p3.z);
-}
-
 void main () {
-    c = texture(ia, geom_p);
+    // newest spectrum on the right edge of the window
+    float t = 1. - geom_p.x;
+    float freq = texture(iSpectrogram, vec2(iSpectrogramOffset - t, exp2(geom_p.y / 1.5) - 1.)).r;
+    c = vec4(log(1. + 10.*freq));
     c.a = 1.;
 }
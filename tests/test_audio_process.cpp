@@ -98,4 +98,57 @@ TEST_CASE("Optimization performance test") {
     CHECK(xcorr_perf > baseline_perf);
     CHECK(xcorr_perf > fft_perf);
     CHECK(xcorr_perf >= 850400);
-}
\ No newline at end of file
+}
+
+// Models a record stream like pulseaudio's: of the audio in flight only the readable part is captured,
+// the rest of the latency is still in the device. Reading past what is readable waits for the capture.
+class CaptureStream : public AudioStream {
+public:
+	int latency_frames = 2400;
+	int readable = 0;
+	// Frames the reads had to wait for
+	int waited_frames = 0;
+	int available_calls = 0;
+
+	void get_next_pcm(float* buff_l, float* buff_r, int buff_size) {
+		read(buff_l, buff_r, buff_size);
+	}
+	int get_available_pcm(float* buff_l, float* buff_r, int max_frames, std::chrono::steady_clock::time_point& capture_time) {
+		++available_calls;
+		capture_time = std::chrono::steady_clock::now() - std::chrono::microseconds(int64_t(latency_frames) * 1000000 / sample_rate);
+		const int n = std::min(max_frames, readable);
+		read(buff_l, buff_r, n);
+		return n;
+	}
+	int get_sample_rate() {
+		return sample_rate;
+	}
+	int get_max_buff_size() {
+		return 512;
+	}
+private:
+	const int sample_rate = 48000;
+	void read(float* buff_l, float* buff_r, int size) {
+		std::fill(buff_l, buff_l + size, 0.f);
+		std::fill(buff_r, buff_r + size, 0.f);
+		waited_frames += std::max(0, size - readable);
+		readable = std::max(0, readable - size);
+	}
+};
+
+TEST_CASE("step doesn't wait for audio that is in flight but not readable") {
+	CaptureStream stream;
+	AudioProcess<fake_clock, CaptureStream> ap(stream, AudioOptions());
+
+	// Only the block that paces the steps is waited for, the latency isn't read as a backlog
+	ap.step();
+	CHECK(stream.waited_frames == ABL);
+	CHECK(stream.available_calls == 1);
+
+	// A backlog is drained in one read, without waiting
+	stream.readable = 3 * ABL + 100;
+	ap.step();
+	CHECK(stream.waited_frames == ABL);
+	CHECK(stream.readable == 0);
+	CHECK(stream.available_calls == 2);
+}
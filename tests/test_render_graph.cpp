@@ -0,0 +1,83 @@
+#include <vector>
+using std::vector;
+
+#include "RenderGraph.h"
+
+#include "catch2/catch.hpp"
+
+// Buffers A = 0, B = 1, C = 2 and the image is program 3
+
+TEST_CASE("passes nothing reads are skipped") {
+	// image reads A, A reads B, nothing reads C
+	vector<vector<bool>> reads = {
+		{false, true, false},
+		{false, false, false},
+		{false, false, false},
+		{true, false, false},
+	};
+	RenderGraph graph({1, 0, 2}, reads, {true, true, true, true}, false);
+	CHECK(graph.passes == vector<int>{1, 0});
+	CHECK(graph.live_buffers == vector<bool>{true, true, false});
+}
+
+TEST_CASE("a buffer read before it is written is read from the previous frame") {
+	// A reads B, but B is drawn after A, so A sees last frame's B
+	vector<vector<bool>> reads = {
+		{false, true, false},
+		{false, false, false},
+		{false, false, false},
+		{true, false, false},
+	};
+	RenderGraph graph({0, 1}, reads, {true, true, true, true}, false);
+	CHECK(graph.passes == vector<int>{0, 1});
+}
+
+TEST_CASE("a pass overwritten before anyone reads it is skipped") {
+	// render_order A, B, A where only the image reads A and B reads nothing. The first A is overwritten.
+	vector<vector<bool>> reads = {
+		{false, false, false},
+		{false, false, false},
+		{false, false, false},
+		{true, false, false},
+	};
+	RenderGraph graph({0, 1, 0}, reads, {true, true, true, true}, false);
+	CHECK(graph.passes == vector<int>{0});
+}
+
+TEST_CASE("a buffer only read by itself is skipped") {
+	// C is a feedback buffer that nothing else reads
+	vector<vector<bool>> reads = {
+		{false, false, false},
+		{false, false, false},
+		{false, false, true},
+		{true, false, false},
+	};
+	RenderGraph graph({0, 2}, reads, {true, true, true, true}, false);
+	CHECK(graph.passes == vector<int>{0});
+}
+
+TEST_CASE("only buffers that sample themselves need two textures") {
+	vector<vector<bool>> reads = {
+		{true, false, false},
+		{true, false, false},
+		{false, false, false},
+		{true, true, false},
+	};
+	RenderGraph graph({0, 1}, reads, {true, true, true, true}, false);
+	CHECK(graph.single_texture[0] == false);
+	CHECK(graph.single_texture[1] == true);
+}
+
+TEST_CASE("targets are only cleared when the pass may not cover them") {
+	vector<vector<bool>> reads = {
+		{false, false, false},
+		{false, false, false},
+		{false, false, false},
+		{true, true, true},
+	};
+	RenderGraph graph({0, 1, 2}, reads, {true, false, true, true}, false);
+	CHECK(graph.clear == vector<bool>{false, true, false, false});
+
+	RenderGraph blended({0, 1, 2}, reads, {true, false, true, true}, true);
+	CHECK(blended.clear == vector<bool>{true, true, true, true});
+}
@@ -753,6 +753,206 @@ TEST_CASE("test valid config 3") {
 	CHECK(true);
 }
 
+TEST_CASE("resolution_scale out of range") {
+	string json_str = R"(
+	{
+		"image" : {
+			"geom_iters":1,
+			"clear_color":[0,0,0]
+		},
+		"buffers":{
+			"A": {
+				"size": "window_size",
+				"geom_iters": 1,
+				"resolution_scale": 2
+			}
+		},
+		"render_order":["A"]
+	}
+	)";
+
+	try {
+		ShaderConfig conf(json_str);
+	}
+	catch (runtime_error& msg) {
+		CHECK(true);
+		return;
+	}
+	CHECK(false);
+}
+TEST_CASE("unknown buffer format") {
+	string json_str = R"(
+	{
+		"image" : {
+			"geom_iters":1,
+			"clear_color":[0,0,0]
+		},
+		"buffers":{
+			"A": {
+				"size": "window_size",
+				"geom_iters": 1,
+				"format": "RGB565"
+			}
+		},
+		"render_order":["A"]
+	}
+	)";
+
+	try {
+		ShaderConfig conf(json_str);
+	}
+	catch (runtime_error& msg) {
+		CHECK(true);
+		return;
+	}
+	CHECK(false);
+}
+TEST_CASE("test valid config 4") {
+	string json_str = R"(
+	{
+		"image" : {
+			"geom_iters":1,
+			"clear_color":[0,0,0]
+		},
+		"buffers":{
+			"A": {
+				"size": "window_size",
+				"geom_iters": 1,
+				"clear_color":[0, 0, 0],
+				"update_every_n_frames": 2,
+				"resolution_scale": 0.5,
+				"format": "RG16F"
+			}
+		},
+		"render_order":["A"]
+	}
+	)";
+	ShaderConfig mock_conf;
+	mock_conf.mInitWinSize.width = 400;
+	mock_conf.mInitWinSize.height = 300;
+	mock_conf.mBlend = false;
+	mock_conf.mAudio_enabled = true;
+    mock_conf.mImage.name = "image";
+
+	Buffer b;
+	b.name = string("A");
+	b.geom_iters = 1;
+	b.is_window_size = true;
+	b.clear_color = {0.f, 0.f, 0.f};
+	b.update_every_n_frames = 2;
+	b.resolution_scale = .5f;
+	b.format = BufferFormat::RG16F;
+	mock_conf.mBuffers.push_back(b);
+	mock_conf.mRender_order = {0};
+	mock_conf.mImage.is_window_size = true;
+	mock_conf.mImage.geom_iters = 1;
+	mock_conf.mImage.clear_color = {0.f, 0.f, 0.f};
+
+	try {
+		ShaderConfig conf(json_str);
+		if (!compare_eq(conf, mock_conf)) {
+			cout << "EXPECTED" << endl;
+			cout << mock_conf << endl << endl;
+			cout << "RETURNED" << endl;
+			cout << conf << endl << endl;
+			throw runtime_error("mock neq parsed");
+		}
+	}
+	catch (runtime_error& msg) {
+		CHECK(false);
+		return;
+	}
+	CHECK(true);
+}
+TEST_CASE("render_order points at the buffers left after unused ones are deleted") {
+	string json_str = R"(
+	{
+		"image" : {
+			"geom_iters":1,
+			"clear_color":[0,0,0]
+		},
+		"buffers":{
+			"unused": {
+				"size": [1, 1],
+				"geom_iters": 1,
+				"clear_color":[0, 0, 0]
+			},
+			"A": {
+				"size": [2, 2],
+				"geom_iters": 1,
+				"clear_color":[0, 0, 0]
+			},
+			"B": {
+				"size": [3, 3],
+				"geom_iters": 1,
+				"clear_color":[0, 0, 0]
+			}
+		},
+		"render_order":["B", "A", "B"]
+	}
+	)";
+	ShaderConfig conf(json_str);
+	REQUIRE(conf.mBuffers.size() == 2);
+	CHECK(conf.mBuffers[conf.mRender_order[0]].name == "B");
+	CHECK(conf.mBuffers[conf.mRender_order[1]].name == "A");
+	CHECK(conf.mBuffers[conf.mRender_order[2]].name == "B");
+	CHECK(conf.mRender_order[0] == conf.mRender_order[2]);
+	for (const Buffer& b : conf.mBuffers)
+		CHECK(b.name != "unused");
+}
+TEST_CASE("too many buffers") {
+	string buffers;
+	string render_order;
+	for (int i = 0; i <= ShaderConfig::MAX_BUFFERS; ++i) {
+		const string name = "b" + std::to_string(i);
+		buffers += (i ? ",\"" : "\"") + name + "\": {\"size\": [1, 1], \"geom_iters\": 1, \"clear_color\": [0, 0, 0]}";
+		render_order += (i ? ",\"" : "\"") + name + "\"";
+	}
+	const string json_str = "{\"buffers\": {" + buffers + "}, \"render_order\": [" + render_order + "]}";
+	CHECK_THROWS_AS(ShaderConfig(json_str), runtime_error);
+}
+TEST_CASE("same render targets") {
+	string json_str = R"(
+	{
+		"image" : {
+			"geom_iters":1,
+			"clear_color":[0,0,0]
+		},
+		"buffers":{
+			"A": {
+				"size": "window_size",
+				"geom_iters": 1,
+				"clear_color":[0, 0, 0]
+			}
+		},
+		"render_order":["A"]
+	}
+	)";
+	const ShaderConfig conf(json_str);
+
+	// Per frame settings don't need new framebuffers
+	ShaderConfig other = conf;
+	other.mBuffers[0].clear_color = {1.f, 1.f, 1.f};
+	other.mBuffers[0].geom_iters = 4;
+	other.mRender_order = {0, 0};
+	CHECK(conf.same_render_targets(other));
+
+	other = conf;
+	other.mBuffers[0].format = BufferFormat::RGBA8;
+	CHECK(!conf.same_render_targets(other));
+
+	other = conf;
+	other.mBuffers[0].is_window_size = false;
+	other.mBuffers[0].width = 64;
+	other.mBuffers[0].height = 64;
+	CHECK(!conf.same_render_targets(other));
+
+	other = conf;
+	other.mBuffers.push_back(conf.mBuffers[0]);
+	other.mBuffers[1].name = "B";
+	CHECK(!conf.same_render_targets(other));
+}
+
 // Convenience operators
 
 static std::ostream& operator<<(std::ostream& os, const Buffer& o) {
@@ -761,6 +961,9 @@ static std::ostream& operator<<(std::ostream& os, const Buffer& o) {
 	os << "width  : " << o.width << "\n";
 	os << "height : " << o.height << "\n";
 	os << "is_window_size: " << o.is_window_size << "\n";
+	os << "update_every_n_frames: " << o.update_every_n_frames << "\n";
+	os << "resolution_scale: " << o.resolution_scale << "\n";
+	os << "format : " << int(o.format) << "\n";
 	return os;
 }
 
@@ -823,7 +1026,10 @@ static bool operator==(const Buffer& l, const Buffer& o) {
 		l.height == o.height &&
 		l.is_window_size == o.is_window_size &&
 		l.geom_iters == o.geom_iters &&
-		l.clear_color == o.clear_color;
+		l.clear_color == o.clear_color &&
+		l.update_every_n_frames == o.update_every_n_frames &&
+		l.resolution_scale == o.resolution_scale &&
+		l.format == o.format;
 }
 
 static bool operator==(const Uniform& l, const Uniform& o) {
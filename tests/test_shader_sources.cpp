@@ -0,0 +1,73 @@
+#include <fstream>
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+#include <stdexcept>
+using std::runtime_error;
+
+#include "ShaderSources.h"
+
+#include "catch2/catch.hpp"
+
+static const filesys::path folder = filesys::temp_directory_path() / "music_visualizer_test_shader_sources";
+
+static void write_file(const string& name, const string& text) {
+	filesys::create_directories((folder / name).parent_path());
+	std::ofstream((folder / name).string(), std::ios::trunc) << text;
+}
+
+TEST_CASE("includes are expanded with line directives") {
+	filesys::remove_all(folder);
+	write_file("image.frag", "a\n#include \"common/quad.glsl\"\nb\n");
+	write_file("common/quad.glsl", "q\n");
+
+	ShaderSources sources(folder);
+	const ShaderSources::Expansion& e = sources.expand("image.frag");
+	CHECK(e.text == "#line 0 0\na\n#line 0 1\nq\n#line 2 0\nb\n");
+	CHECK(e.files == vector<string>{"image.frag", "common/quad.glsl"});
+}
+
+TEST_CASE("a file is included once and paths are relative to the including file") {
+	filesys::remove_all(folder);
+	write_file("A.geom", "#include \"lib/a.glsl\"\n#include \"lib/b.glsl\"\nmain\n");
+	write_file("lib/a.glsl", "# include \"../lib/b.glsl\"\na\n");
+	write_file("lib/b.glsl", "b\n");
+
+	ShaderSources sources(folder);
+	const ShaderSources::Expansion& e = sources.expand("A.geom");
+	CHECK(e.text == "#line 0 0\n#line 0 1\n#line 0 2\nb\n#line 1 1\na\n#line 1 0\n\nmain\n");
+	CHECK(e.files == vector<string>{"A.geom", "lib/a.glsl", "lib/b.glsl"});
+}
+
+TEST_CASE("include errors") {
+	filesys::remove_all(folder);
+	write_file("cycle.frag", "#include \"x.glsl\"\n");
+	write_file("x.glsl", "#include \"cycle.frag\"\n");
+	write_file("missing.frag", "#include \"nothing.glsl\"\n");
+	write_file("unquoted.frag", "\n#include <x.glsl>\n");
+
+	ShaderSources sources(folder);
+	CHECK_THROWS_AS(sources.expand("cycle.frag"), runtime_error);
+	CHECK_THROWS_AS(sources.expand("missing.frag"), runtime_error);
+	CHECK_THROWS_WITH(sources.expand("unquoted.frag"), Catch::Contains("unquoted.frag:2"));
+}
+
+TEST_CASE("refresh drops the expansions that read a changed file") {
+	filesys::remove_all(folder);
+	write_file("A.frag", "#include \"shared.glsl\"\n");
+	write_file("B.frag", "b\n");
+	write_file("shared.glsl", "1\n");
+
+	ShaderSources sources(folder);
+	const string b = sources.expand("B.frag").text;
+	CHECK(sources.expand("A.frag").text == "#line 0 0\n#line 0 1\n1\n#line 1 0\n");
+
+	write_file("shared.glsl", "2\n");
+	// Make sure the write time differs on file systems with coarse timestamps
+	filesys::last_write_time(folder / "shared.glsl", filesys::last_write_time(folder / "shared.glsl") + std::chrono::seconds(2));
+	sources.refresh();
+	CHECK(sources.expand("A.frag").text == "#line 0 0\n#line 0 1\n2\n#line 1 0\n");
+	CHECK(sources.expand("B.frag").text == b);
+	filesys::remove_all(folder);
+}
@@ -0,0 +1,122 @@
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+#include <cstdint>
+#include <cstring>
+
+#include "UniformControl.h"
+#include "UniformStore.h"
+
+#include "catch2/catch.hpp"
+
+// OSC strings are null terminated and padded to a multiple of 4 bytes
+static void put_string(string& packet, const string& s) {
+	packet += s;
+	packet.append(4 - s.size() % 4, '\0');
+}
+
+static void put_u32(string& packet, uint32_t v) {
+	for (int shift = 24; shift >= 0; shift -= 8)
+		packet += char((v >> shift) & 0xff);
+}
+
+static void put_float(string& packet, float f) {
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	put_u32(packet, bits);
+}
+
+struct Message {
+	string address;
+	vector<float> args;
+};
+
+static vector<Message> parse(const string& packet) {
+	vector<Message> messages;
+	UniformControl::parse_packet(packet.data(), packet.size(), [&](const string& address, const vector<float>& args) {
+		messages.push_back({address, args});
+	});
+	return messages;
+}
+
+TEST_CASE("osc messages are parsed") {
+	string packet;
+	put_string(packet, "/desk/color");
+	put_string(packet, ",fiT");
+	put_float(packet, 0.25f);
+	put_u32(packet, uint32_t(-3));
+
+	const vector<Message> messages = parse(packet);
+	REQUIRE(messages.size() == 1);
+	CHECK(messages[0].address == "/desk/color");
+	CHECK(messages[0].args == vector<float>{0.25f, -3.f, 1.f});
+
+	// Truncated arguments and unknown types are skipped
+	CHECK(parse(packet.substr(0, packet.size() - 2)).empty());
+	string unknown;
+	put_string(unknown, "/a");
+	put_string(unknown, ",fs");
+	put_float(unknown, 1.f);
+	put_string(unknown, "text");
+	CHECK(parse(unknown).empty());
+}
+
+TEST_CASE("the messages of osc bundles are parsed in order") {
+	string a;
+	put_string(a, "/a");
+	put_string(a, ",f");
+	put_float(a, 1.f);
+	string b;
+	put_string(b, "/b");
+	put_string(b, ",ff");
+	put_float(b, 2.f);
+	put_float(b, 3.f);
+
+	string inner;
+	put_string(inner, "#bundle");
+	put_u32(inner, 0);
+	put_u32(inner, 1);
+	put_u32(inner, uint32_t(b.size()));
+	inner += b;
+
+	string packet;
+	put_string(packet, "#bundle");
+	put_u32(packet, 0);
+	put_u32(packet, 1);
+	put_u32(packet, uint32_t(a.size()));
+	packet += a;
+	put_u32(packet, uint32_t(inner.size()));
+	packet += inner;
+
+	const vector<Message> messages = parse(packet);
+	REQUIRE(messages.size() == 2);
+	CHECK(messages[0].address == "/a");
+	CHECK(messages[0].args == vector<float>{1.f});
+	CHECK(messages[1].address == "/b");
+	CHECK(messages[1].args == vector<float>{2.f, 3.f});
+}
+
+TEST_CASE("the uniform store hands the latest published values to the reader") {
+	UniformStore store;
+	CHECK_FALSE(store.take());
+	CHECK(store.front().generation == 0);
+
+	for (int generation = 1; generation <= 2; ++generation) {
+		store.back().generation = generation;
+		store.back().values["color"] = {float(generation)};
+		store.publish();
+	}
+	REQUIRE(store.take());
+	CHECK(store.front().generation == 2);
+	CHECK(store.front().values.at("color") == vector<float>{2.f});
+	CHECK_FALSE(store.take());
+	CHECK(store.front().generation == 2);
+
+	// The writer never fills the snapshot the reader holds
+	store.back().generation = 3;
+	CHECK(store.front().generation == 2);
+	store.publish();
+	REQUIRE(store.take());
+	CHECK(store.front().generation == 3);
+}